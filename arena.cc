@@ -0,0 +1,22 @@
+// arena.cc
+
+#include "arena.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// blocks double in size up to this, so small graphs stay small
+static const size_t max_block_size = 1 << 20;
+
+void *Arena::allocate_from_new_block(size_t size, size_t align) {
+  // room to align the start, new[] only promises the fundamental alignments
+  size_t block_size = max(block_size_, size + align - 1);
+  blocks_.emplace_back(new char[block_size]);
+  block_size_ = min(2 * block_size_, max_block_size);
+  char *block = blocks_.back().get();
+  size_t padding = -reinterpret_cast<uintptr_t>(block) & (align - 1);
+  next_ = block + padding + size;
+  left_ = block_size - padding - size;
+  return block + padding;
+}
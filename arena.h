@@ -0,0 +1,65 @@
+// arena.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+ * A monotonic allocator.  Objects are carved out of large blocks and never
+ * freed one at a time; all of the blocks are released together when the arena
+ * is destroyed.  Destructors are not run, so only put objects here whose
+ * destructors have nothing to do.
+ */
+class Arena {
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char *next_;
+  size_t left_;
+  size_t block_size_;
+
+  void *allocate_from_new_block(size_t size, size_t align);
+
+public:
+  explicit Arena(size_t block_size = 1 << 16)
+      : next_(nullptr), left_(0), block_size_(block_size) {}
+  Arena(const Arena &) = delete;
+  // the moved from arena is left empty, not pointing into the blocks it gave up
+  Arena(Arena &&arena)
+      : blocks_(std::move(arena.blocks_)), next_(arena.next_),
+        left_(arena.left_), block_size_(arena.block_size_) {
+    arena.blocks_.clear();
+    arena.next_ = nullptr;
+    arena.left_ = 0;
+  }
+  Arena &operator=(const Arena &) = delete;
+  Arena &operator=(Arena &&arena) {
+    blocks_ = std::move(arena.blocks_);
+    next_ = arena.next_;
+    left_ = arena.left_;
+    block_size_ = arena.block_size_;
+    arena.blocks_.clear();
+    arena.next_ = nullptr;
+    arena.left_ = 0;
+    return *this;
+  }
+
+  // align must be a power of two
+  void *allocate(size_t size, size_t align) {
+    size_t padding = -reinterpret_cast<uintptr_t>(next_) & (align - 1);
+    if (padding + size > left_) {
+      return allocate_from_new_block(size, align);
+    }
+    void *result = next_ + padding;
+    next_ += padding + size;
+    left_ -= padding + size;
+    return result;
+  }
+
+  template <typename T, typename... Args> T *create(Args &&... args) {
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+};
@@ -0,0 +1,118 @@
+// bench_geometry.cc
+
+#include "geometry.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+double seconds(const function<void()> &f) {
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void report(const string &name, double elapsed, size_t tests, size_t hits) {
+  cout << name << ": " << 1e9 * elapsed / tests << " ns per test, " << hits
+       << " hits" << endl;
+}
+
+/*
+ * Tests a batch of node sized boxes and of edge segments between them, spread
+ * over a large drawing, against view boxes, with the Rectangle::Intersects
+ * functions one at a time and with the batched overlaps kernels, e.g.
+ *   ./bench_geometry 100000 100
+ * The hit counts differ: Intersects only counts segments that cross a side of
+ * the view box (and takes them as infinite lines), overlaps counts any part
+ * inside.
+ */
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+  size_t rounds = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100;
+  const double size = 100000;
+  mt19937 random(count);
+  uniform_real_distribution<double> coordinate(0, size);
+  uniform_real_distribution<double> offset(-2000, 2000);
+
+  vector<Rectangle> boxes;
+  vector<LineSegment> segments;
+  Rectangles box_batch;
+  LineSegments segment_batch;
+  for (size_t i = 0; i < count; ++i) {
+    Point position(coordinate(random), coordinate(random));
+    boxes.emplace_back(position, Extent(120, 30));
+    segments.emplace_back(position, position + Point(offset(random),
+                                                     offset(random)));
+    box_batch.push_back(boxes.back());
+    segment_batch.push_back(segments.back());
+  }
+  vector<Rectangle> views;
+  for (size_t i = 0; i < rounds; ++i) {
+    views.emplace_back(Point(coordinate(random), coordinate(random)),
+                       Extent(4000, 3000));
+  }
+
+  vector<uint8_t> mask(count);
+  size_t tests = count * rounds;
+  size_t hits = 0;
+  double elapsed = seconds([&]() {
+    for (auto &&view : views) {
+      for (auto &&box : boxes) {
+        hits += view.Intersects(box);
+      }
+    }
+  });
+  report("Rectangle::Intersects(Rectangle)", elapsed, tests, hits);
+
+  hits = 0;
+  elapsed = seconds([&]() {
+    for (auto &&view : views) {
+      overlaps(view, box_batch, mask.data());
+      for (auto hit : mask) {
+        hits += hit;
+      }
+    }
+  });
+  report("overlaps(Rectangles)", elapsed, tests, hits);
+
+  hits = 0;
+  elapsed = seconds([&]() {
+    for (auto &&view : views) {
+      for (auto &&segment : segments) {
+        hits += view.Intersects(segment);
+      }
+    }
+  });
+  report("Rectangle::Intersects(LineSegment)", elapsed, tests, hits);
+
+  hits = 0;
+  elapsed = seconds([&]() {
+    for (auto &&view : views) {
+      overlaps(view, segment_batch, mask.data());
+      for (auto hit : mask) {
+        hits += hit;
+      }
+    }
+  });
+  report("overlaps(LineSegments)", elapsed, tests, hits);
+
+  // the single versions of the kernels must agree with the batches
+  size_t disagree = 0;
+  overlaps(views.front(), segment_batch, mask.data());
+  for (size_t i = 0; i < count; ++i) {
+    disagree += mask[i] != views.front().Overlaps(segments[i]);
+  }
+  overlaps(views.front(), box_batch, mask.data());
+  for (size_t i = 0; i < count; ++i) {
+    disagree += mask[i] != views.front().Overlaps(boxes[i]);
+  }
+  if (disagree) {
+    cout << disagree << " batched results disagree" << endl;
+    return 1;
+  }
+}
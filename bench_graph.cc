@@ -0,0 +1,48 @@
+// bench_graph.cc
+
+#include "binary_graph.h"
+#include "graph.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+/*
+ * Times the loops that go from the bases back to Node and Edge, e.g.
+ *   ./bench_graph main.call_graph 1000
+ * Each pass visits every edge from both ends, like dump_call_graph.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    cerr << "usage: ./bench_graph call_graph_file [passes]" << endl;
+    return -1;
+  }
+  size_t passes = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100;
+  Graph graph = is_binary_call_graph_file(argv[1])
+                    ? loadBinaryCallGraphFromFile(argv[1])
+                    : parseCallGraphFromFile(argv[1]);
+
+  size_t checksum = 0;
+  auto start = chrono::steady_clock::now();
+  for (size_t pass = 0; pass < passes; ++pass) {
+    for (const NodeBase *node : graph.nodes) {
+      for (auto edge : node->neighborhood.outgoing) {
+        checksum += as_node(edge->head)->fullname.size() +
+                    as_edge(edge)->range.begin.line;
+      }
+      for (auto edge : node->neighborhood.incoming) {
+        checksum += as_node(edge->tail)->fullname.size() +
+                    as_edge(edge)->range.end.line;
+      }
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  size_t visits = 2 * graph.edges.size() * passes;
+  cout << graph.nodes.size() << " nodes, " << graph.edges.size() << " edges, "
+       << passes << " passes in " << elapsed.count() << " s ("
+       << 1e9 * elapsed.count() / visits << " ns per edge visit, checksum "
+       << checksum << ")" << endl;
+}
@@ -0,0 +1,118 @@
+// bench_layout.cc
+
+#include "binary_graph.h"
+#include "graph.h"
+#include "graph_layout_algorithms.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Synthetic call graphs: a star (main calls every other function, so they all
+ * land in one column), a tree where each function calls up to 4 others, and a
+ * "calls" graph: the tree with each function calling 3 random functions among
+ * its children and its siblings' children instead, and now and then one
+ * function before it (recursion through a cycle).
+ */
+Graph make_graph(const string &shape, size_t node_count) {
+  Graph graph;
+  vector<Node *> nodes;
+  for (size_t i = 0; i < node_count; ++i) {
+    nodes.push_back(graph.try_createNode("f" + to_string(i) + "()").first);
+  }
+  if (shape == "calls") {
+    mt19937 random(node_count);
+    for (size_t i = 0; i < node_count; ++i) {
+      for (int call = 0; call < 3; ++call) {
+        size_t callee = 4 * i + 1 + random() % 12;
+        if (callee < node_count) {
+          graph.try_createEdge(nodes[i], nodes[callee]);
+        }
+      }
+      if (i && random() % 16 == 0) {
+        graph.try_createEdge(nodes[i], nodes[random() % i]);
+      }
+    }
+  } else {
+    for (size_t i = 1; i < node_count; ++i) {
+      graph.try_createEdge(nodes[shape == "star" ? 0 : (i - 1) / 4], nodes[i]);
+    }
+  }
+  graph.build_adjacency();
+  return graph;
+}
+
+/*
+ * Everything visible, with fixed size boxes in place of the text extents
+ */
+View make_view(const Graph &graph) {
+  View view(&graph.names, &graph.name_to_node);
+  for (auto node : graph.nodes) {
+    view.viewData[node] = {make_shared<Rectangle>(Point(), Extent(120, 30)),
+                           "", true};
+    view.logicalSubView.insert(node);
+  }
+  view.roots = graph.get_roots();
+  return view;
+}
+
+double seconds(const function<void()> &f) {
+  auto start = chrono::steady_clock::now();
+  f();
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * The mean distance between the boxes of a caller and a callee, a rough
+ * measure of how readable the result is
+ */
+double mean_edge_length(const Graph &graph, const View &view) {
+  double sum = 0;
+  for (auto edge : graph.edges) {
+    Point d = view.viewData.at(edge->head).box->position -
+              view.viewData.at(edge->tail).box->position;
+    sum += sqrt(d * d);
+  }
+  return graph.edges.empty() ? 0 : sum / graph.edges.size();
+}
+
+void run(const string &name, const Graph &graph) {
+  for (string algorithm : {"dfs", "layered", "force"}) {
+    View view = make_view(graph);
+    LayoutAlgorithm layout = find_layout_algorithm(algorithm);
+    double elapsed = seconds([&view, layout]() { layout(view); });
+    cout << name << " " << algorithm << ": " << elapsed << " s ("
+         << 1e6 * elapsed / graph.nodes.size() << " us per node), mean edge "
+         << mean_edge_length(graph, view) << endl;
+  }
+}
+
+/*
+ * Times the layouts on synthetic graphs of increasing size, and on a call
+ * graph file if one is given, e.g.
+ *   ./bench_layout 50000 main.call_graph
+ */
+int main(int argc, char *argv[]) {
+  size_t max_nodes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 50000;
+  if (argc > 2) {
+    Graph graph = is_binary_call_graph_file(argv[2])
+                      ? loadBinaryCallGraphFromFile(argv[2])
+                      : parseCallGraphFromFile(argv[2]);
+    run(argv[2], graph);
+  }
+  for (string shape : {"star", "tree", "calls"}) {
+    for (size_t count = 1000; count <= max_nodes; count *= 2) {
+      Graph graph = make_graph(shape, count);
+      run(shape + " " + to_string(count) + " nodes", graph);
+    }
+  }
+}
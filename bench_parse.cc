@@ -0,0 +1,61 @@
+// bench_parse.cc
+
+#include "graph.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+/*
+ * Times parseCallGraphFromFile on a call graph file replicated until it is
+ * megabytes long, e.g.
+ *   ./bench_parse main.call_graph 1024
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    cerr << "usage: ./bench_parse call_graph_file [megabytes]" << endl;
+    return -1;
+  }
+  size_t megabytes = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1024;
+  ostringstream text;
+  text << ifstream(argv[1]).rdbuf();
+  string copy = text.str();
+  if (copy.empty()) {
+    cerr << "couldn't read " << argv[1] << endl;
+    return -1;
+  }
+
+  string filename = string(argv[1]) + ".bench";
+  size_t size = 0;
+  {
+    ofstream replicated(filename);
+    for (; size < megabytes << 20; size += copy.size()) {
+      replicated << copy;
+    }
+  }
+
+  size_t nodes;
+  size_t edges;
+  chrono::duration<double> elapsed;
+  auto start = chrono::steady_clock::now();
+  {
+    Graph graph = parseCallGraphFromFile(filename);
+    elapsed = chrono::steady_clock::now() - start;
+    nodes = graph.nodes.size();
+    edges = graph.edges.size();
+    start = chrono::steady_clock::now();
+  }
+  chrono::duration<double> teardown = chrono::steady_clock::now() - start;
+  remove(filename.c_str());
+
+  cout << (size >> 20) << " MB, " << nodes << " nodes, " << edges
+       << " edges in " << elapsed.count() << " s ("
+       << (size >> 20) / elapsed.count() << " MB/s), destroyed in "
+       << teardown.count() << " s" << endl;
+}
@@ -0,0 +1,267 @@
+// binary_graph.cc
+
+#include "binary_graph.h"
+#include "mapped_file.h"
+#include "myassert.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+static const char binary_magic[8] = {'C', 'G', 'R', 'A', 'P', 'H', 0, 2};
+// the part of the magic number that does not change between versions
+static const size_t binary_magic_prefix = 7;
+
+struct BinaryGraphHeader {
+  char magic[8];
+  uint32_t string_count;
+  uint32_t node_count;
+  uint64_t string_bytes;
+  uint64_t edge_count;
+};
+
+struct PackedLocation {
+  uint32_t filename; // index into the string table
+  uint32_t line;
+  uint32_t column;
+  uint32_t offset;
+};
+
+struct PackedRange {
+  PackedLocation begin;
+  PackedLocation end;
+};
+
+struct PackedNode {
+  uint32_t name; // index into the string table
+  PackedRange range;
+};
+
+size_t padded(size_t size) { return (size + 7) & ~size_t(7); }
+
+/*
+ * Assigns each distinct string an index in order of first appearance
+ */
+class StringTableBuilder {
+public:
+  SymbolTable strings;
+  uint64_t bytes = 0;
+
+  uint32_t operator()(const string &s) {
+    auto kv = strings.intern(s);
+    if (kv.second) {
+      bytes += s.size();
+    }
+    return kv.first;
+  }
+};
+
+PackedRange pack(const SourceRange &range, StringTableBuilder &strings) {
+  return {{strings(*range.begin.filename), (uint32_t)range.begin.line,
+           (uint32_t)range.begin.column, (uint32_t)range.begin.offset},
+          {strings(*range.end.filename), (uint32_t)range.end.line,
+           (uint32_t)range.end.column, (uint32_t)range.end.offset}};
+}
+
+template <typename T> void write_section(ostream &o, const vector<T> &v) {
+  o.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+  size_t size = v.size() * sizeof(T);
+  o.write("\0\0\0\0\0\0\0", padded(size) - size);
+}
+
+bool is_binary_call_graph_file(const string &filename) {
+  char magic[sizeof(binary_magic)];
+  ifstream file(filename, ios::binary);
+  return file.read(magic, sizeof(magic)) &&
+         !memcmp(magic, binary_magic, binary_magic_prefix);
+}
+
+void dump_binary_call_graph(const Graph &graph, ostream &o) {
+  StringTableBuilder strings;
+  vector<PackedNode> nodes;
+  vector<uint32_t> edge_offsets{0};
+  vector<uint32_t> heads;
+  vector<PackedRange> edges;
+  vector<uint32_t> calls;
+
+  nodes.reserve(graph.nodes.size());
+  for (auto node : graph.nodes) {
+    nodes.push_back({strings(node->fullname), pack(node->range, strings)});
+  }
+  heads.reserve(graph.edges.size());
+  edges.reserve(graph.edges.size());
+  calls.reserve(graph.edges.size());
+  for (auto node : graph.nodes) {
+    for (auto edge : node->neighborhood.outgoing) {
+      // node ids are indices into graph.nodes, so they are the record indices
+      heads.push_back(edge->head->id);
+      const Edge *e = as_edge(edge);
+      edges.push_back(pack(e->range, strings));
+      calls.push_back(e->calls);
+    }
+    edge_offsets.push_back(heads.size());
+  }
+
+  vector<uint64_t> string_offsets{0};
+  vector<char> characters;
+  characters.reserve(strings.bytes);
+  for (NameId i = 0; i < strings.strings.size(); ++i) {
+    const string &s = strings.strings.name(i);
+    characters.insert(characters.end(), s.begin(), s.end());
+    string_offsets.push_back(characters.size());
+  }
+
+  BinaryGraphHeader header;
+  memcpy(header.magic, binary_magic, sizeof(binary_magic));
+  header.string_count = strings.strings.size();
+  header.node_count = nodes.size();
+  header.string_bytes = characters.size();
+  header.edge_count = heads.size();
+
+  write_section(o, vector<BinaryGraphHeader>{header});
+  write_section(o, string_offsets);
+  write_section(o, characters);
+  write_section(o, nodes);
+  write_section(o, edge_offsets);
+  write_section(o, heads);
+  write_section(o, edges);
+  write_section(o, calls);
+}
+
+/*
+ * Walks the sections of a mapped file, checking that each one fits
+ */
+class SectionReader {
+  const char *p_;
+  const char *end_;
+
+public:
+  SectionReader(const char *begin, const char *end) : p_(begin), end_(end) {}
+
+  template <typename T> const T *next(size_t count) {
+    size_t size = count * sizeof(T);
+    if (count > (size_t)(end_ - p_) / sizeof(T) ||
+        padded(size) > (size_t)(end_ - p_)) {
+      return nullptr;
+    }
+    const T *result = reinterpret_cast<const T *>(p_);
+    p_ += padded(size);
+    return result;
+  }
+};
+
+Graph loadBinaryCallGraphFromFile(const string &filename) {
+  Graph graph;
+  MappedFile file(filename);
+  if (!file) {
+    DIAGNOSTIC << "couldn't map " << filename << endl;
+    return graph;
+  }
+
+  SectionReader reader(file.data(), file.end());
+  const BinaryGraphHeader *header = reader.next<BinaryGraphHeader>(1);
+  if (!header || memcmp(header->magic, binary_magic, binary_magic_prefix)) {
+    DIAGNOSTIC << filename << " is not a binary call graph" << endl;
+    return graph;
+  }
+  if (memcmp(header->magic, binary_magic, sizeof(binary_magic))) {
+    DIAGNOSTIC << filename << " has binary format version "
+               << (int)header->magic[binary_magic_prefix] << ", expected "
+               << (int)binary_magic[binary_magic_prefix] << endl;
+    return graph;
+  }
+  // counts the file can't hold are corrupt, and the + 1 below can't wrap
+  size_t string_count = header->string_count;
+  size_t node_count = header->node_count;
+  if (string_count >= file.size() / sizeof(uint64_t) ||
+      node_count >= file.size() / sizeof(uint32_t)) {
+    DIAGNOSTIC << filename << " is corrupt" << endl;
+    return graph;
+  }
+  const uint64_t *string_offsets = reader.next<uint64_t>(string_count + 1);
+  const char *characters = reader.next<char>(header->string_bytes);
+  const PackedNode *nodes = reader.next<PackedNode>(header->node_count);
+  const uint32_t *edge_offsets = reader.next<uint32_t>(node_count + 1);
+  const uint32_t *heads = reader.next<uint32_t>(header->edge_count);
+  const PackedRange *edges = reader.next<PackedRange>(header->edge_count);
+  const uint32_t *calls = reader.next<uint32_t>(header->edge_count);
+  if (!calls) {
+    DIAGNOSTIC << filename << " is truncated" << endl;
+    return graph;
+  }
+
+  // check every index once here, so the loops below can trust them
+  bool valid = string_offsets[header->string_count] == header->string_bytes &&
+               edge_offsets[header->node_count] == header->edge_count;
+  for (uint32_t i = 0; valid && i < header->string_count; ++i) {
+    valid = string_offsets[i] <= string_offsets[i + 1];
+  }
+  auto valid_range = [header](const PackedRange &range) {
+    return range.begin.filename < header->string_count &&
+           range.end.filename < header->string_count;
+  };
+  for (uint32_t i = 0; valid && i < header->node_count; ++i) {
+    valid = nodes[i].name < header->string_count &&
+            valid_range(nodes[i].range) &&
+            edge_offsets[i] <= edge_offsets[i + 1];
+  }
+  for (uint64_t i = 0; valid && i < header->edge_count; ++i) {
+    valid = heads[i] < header->node_count && valid_range(edges[i]);
+  }
+  if (!valid) {
+    DIAGNOSTIC << filename << " is corrupt" << endl;
+    return graph;
+  }
+
+  vector<string> strings;
+  strings.reserve(header->string_count);
+  for (uint32_t i = 0; i < header->string_count; ++i) {
+    strings.emplace_back(characters + string_offsets[i],
+                         string_offsets[i + 1] - string_offsets[i]);
+  }
+  // file names are interned in the graph the first time they are used
+  vector<const string *> files(header->string_count, nullptr);
+  auto file_name = [&graph, &strings, &files](uint32_t i) {
+    if (!files[i]) {
+      files[i] = &graph.files.name(graph.files.intern(strings[i]).first);
+    }
+    return files[i];
+  };
+  auto unpack = [&file_name](const PackedRange &range) {
+    return SourceRange{{file_name(range.begin.filename), range.begin.line,
+                        range.begin.column, range.begin.offset},
+                       {file_name(range.end.filename), range.end.line,
+                        range.end.column, range.end.offset}};
+  };
+
+  graph.nodes.reserve(header->node_count);
+  graph.edges.reserve(header->edge_count);
+  graph.name_to_edge.reserve(header->edge_count);
+  graph.names.reserve(header->node_count);
+  graph.name_to_node.reserve(header->node_count);
+  for (uint32_t i = 0; i < header->node_count; ++i) {
+    graph.try_createNode(strings[nodes[i].name]).first->range =
+        unpack(nodes[i].range);
+  }
+  if (graph.nodes.size() != header->node_count) {
+    DIAGNOSTIC << filename << " has duplicate node names" << endl;
+    return Graph();
+  }
+  for (uint32_t tail = 0; tail < header->node_count; ++tail) {
+    for (uint32_t i = edge_offsets[tail]; i < edge_offsets[tail + 1]; ++i) {
+      auto edge_pair =
+          graph.try_createEdge(graph.nodes[tail], graph.nodes[heads[i]]);
+      edge_pair.first->range = unpack(edges[i]);
+      edge_pair.first->calls = calls[i];
+    }
+  }
+  if (graph.edges.size() != header->edge_count) {
+    DIAGNOSTIC << filename << " has duplicate edges" << endl;
+    return Graph();
+  }
+  graph.build_adjacency();
+  return graph;
+}
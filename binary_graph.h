@@ -0,0 +1,30 @@
+// binary_graph.h
+#pragma once
+
+#include "graph.h"
+
+#include <iostream>
+#include <string>
+
+/*
+ * A compact binary encoding of the call graph, meant to be mapped into memory
+ * and turned into a Graph without any text parsing.  The file holds, in order:
+ *
+ *   BinaryGraphHeader
+ *   string table: string_count + 1 offsets into the character data, then the
+ *     character data (function names and file names, each stored once)
+ *   nodes: one packed record per node (name, source range)
+ *   CSR adjacency: node_count + 1 offsets into the edge arrays, then the head
+ *     node of each edge, grouped by tail
+ *   edges: one packed source range per edge, in the same order as the heads
+ *   calls: the number of call sites of each edge, in the same order
+ *
+ * The last byte of the magic number is the format version, files of another
+ * version are recognized but refused.  Every section starts on an 8 byte
+ * boundary.  Integers are stored in the byte order of the machine that wrote
+ * the file.
+ */
+
+bool is_binary_call_graph_file(const std::string &filename);
+void dump_binary_call_graph(const Graph &graph, std::ostream &o);
+Graph loadBinaryCallGraphFromFile(const std::string &filename);
@@ -2,11 +2,17 @@
 
 #include "drawingarea_zoom_drag.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <utility>
 
 using namespace std;
 
 const double zoom_factor = 1.1;
+const int tile_size = 256;    // pixels
+const size_t max_tiles = 256; // 256KB each
+const int64_t tile_ring = 1;  // tiles rendered ahead around the view
 
 // does not work on matrices with shearing properties
 double get_scale_from_matrix(const Cairo::Matrix &m) {
@@ -31,10 +37,93 @@ ostream &operator<<(ostream &o, const Cairo::Matrix &m) {
   return o;
 }
 
+static Cairo::RefPtr<Cairo::ImageSurface>
+render_tile(const TileWorker::Draw &draw, const TileKey &key) {
+  double tile_scale = pow(zoom_factor, get<0>(key));
+  auto surface =
+      Cairo::ImageSurface::create(Cairo::FORMAT_ARGB32, tile_size, tile_size);
+  auto c = Cairo::Context::create(surface);
+  c->translate(-double(get<1>(key) * tile_size),
+               -double(get<2>(key) * tile_size));
+  c->scale(tile_scale, tile_scale);
+  draw(c);
+  return surface;
+}
+
+TileWorker::TileWorker(Done done) : done_(move(done)), stop_(false) {
+  dispatcher_.connect([this]() { deliver(); });
+  unsigned count = max(1u, min(4u, thread::hardware_concurrency() / 2));
+  for (unsigned i = 0; i < count; ++i) {
+    threads_.emplace_back(&TileWorker::work, this);
+  }
+}
+
+TileWorker::~TileWorker() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &&t : threads_) {
+    t.join();
+  }
+}
+
+void TileWorker::run(vector<Job> jobs) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    pending_.clear();
+    for (auto &&job : jobs) {
+      if (!running_.count(job.id)) {
+        pending_.push_back(move(job));
+      }
+    }
+  }
+  wake_.notify_all();
+}
+
+void TileWorker::work() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+    if (stop_) {
+      return;
+    }
+    Job job = move(pending_.front());
+    pending_.pop_front();
+    running_.insert(job.id);
+    lock.unlock();
+    auto surface = render_tile(*job.draw, job.key);
+    lock.lock();
+    running_.erase(job.id);
+    // moved, never copied: the surface's RefPtr doesn't count atomically
+    finished_.push_back(Finished{move(job), move(surface)});
+    dispatcher_.emit();
+  }
+}
+
+void TileWorker::deliver() {
+  vector<Finished> finished;
+  {
+    lock_guard<mutex> lock(mutex_);
+    finished.swap(finished_);
+  }
+  for (auto &&tile : finished) {
+    done_(tile.job, move(tile.surface));
+  }
+}
+
 DrawingArea_ZoomDrag::DrawingArea_ZoomDrag()
     : m{Cairo::identity_matrix()}, drag_(false), change_since_last_draw_(true),
       last_pos_(0, 0),
-      what_to_drag_(nullptr), zoomed_draw{[](CContext) { return false; }} {
+      what_to_drag_(nullptr), frame_(0), last_request_(0), image_version_(0),
+      snapshot_version_(0),
+      tile_worker_([this](const TileWorker::Job &job,
+                          Cairo::RefPtr<Cairo::ImageSurface> surface) {
+        tile_rendered(job, move(surface));
+      }),
+      zoomed_draw{[](CContext) { return false; }},
+      prepare_draw{[](const Rectangle &) { return false; }} {
   add_events(Gdk::SCROLL_MASK | Gdk::BUTTON_PRESS_MASK |
              Gdk::BUTTON_RELEASE_MASK | Gdk::POINTER_MOTION_MASK);
 }
@@ -42,7 +131,14 @@ DrawingArea_ZoomDrag::DrawingArea_ZoomDrag()
 DrawingArea_ZoomDrag::DrawingArea_ZoomDrag(
     std::function<bool(CContext)> zoomed_draw)
     : m{Cairo::identity_matrix()}, drag_(false), change_since_last_draw_(true),
-      last_pos_(0, 0), what_to_drag_(nullptr), zoomed_draw{zoomed_draw} {
+      last_pos_(0, 0), what_to_drag_(nullptr), frame_(0), last_request_(0),
+      image_version_(0), snapshot_version_(0),
+      tile_worker_([this](const TileWorker::Job &job,
+                          Cairo::RefPtr<Cairo::ImageSurface> surface) {
+        tile_rendered(job, move(surface));
+      }),
+      zoomed_draw{zoomed_draw},
+      prepare_draw{[](const Rectangle &) { return false; }} {
   add_events(Gdk::SCROLL_MASK | Gdk::BUTTON_PRESS_MASK |
              Gdk::BUTTON_RELEASE_MASK | Gdk::POINTER_MOTION_MASK);
 }
@@ -62,7 +158,11 @@ bool DrawingArea_ZoomDrag::on_button_press_event(GdkEventButton *e) {
 bool DrawingArea_ZoomDrag::on_button_release_event(GdkEventButton *e) {
   if (e->button == 1) { // left click
     drag_ = false;
-    what_to_drag_.reset();
+    if (what_to_drag_) {
+      // the tiles weren't rendered ahead while the item moved
+      what_to_drag_.reset();
+      queue_draw();
+    }
   }
   return false;
 }
@@ -74,23 +174,270 @@ bool DrawingArea_ZoomDrag::on_motion_notify_event(GdkEventMotion *e) {
   Point new_pos(e->x, e->y);
   Point translate = (new_pos - last_pos_);
   if (what_to_drag_) {
+    // only where the item was and where it is now
+    queue_draw_image_area(*what_to_drag_);
     translate_item(what_to_drag_->position, translate);
+    queue_draw_image_area(*what_to_drag_);
   } else {
     translate_matrix(translate);
     set_changed();
+    queue_draw();
   }
   last_pos_ = new_pos;
-  queue_draw();
   return false;
 }
 
 bool DrawingArea_ZoomDrag::on_draw(CContext c) {
-  c->set_matrix(m * c->get_matrix());
-  bool result = zoomed_draw(c);
+  // the zoom level closest to the scale, tiles are rendered at its scale
+  int level = int(lround(log(get_scale_from_matrix(m)) / log(zoom_factor)));
+  double tile_extent = tile_size / pow(zoom_factor, level); // in image space
+  auto tile_range = [tile_extent](const Rectangle &box, int64_t &x0,
+                                  int64_t &y0, int64_t &x1, int64_t &y1) {
+    x0 = int64_t(floor(box.position.x / tile_extent));
+    y0 = int64_t(floor(box.position.y / tile_extent));
+    x1 = int64_t(floor((box.position.x + box.extent.x) / tile_extent));
+    y1 = int64_t(floor((box.position.y + box.extent.y) / tile_extent));
+  };
+  Rectangle view(Point(0, 0), Extent(get_width(), get_height()));
+  user_to_image(view);
+  int64_t x0, y0, x1, y1;
+  tile_range(view, x0, y0, x1, y1);
+  // with the ring of tiles rendered ahead
+  Rectangle area(Point((x0 - tile_ring) * tile_extent,
+                       (y0 - tile_ring) * tile_extent),
+                 Extent((x1 - x0 + 1 + 2 * tile_ring) * tile_extent,
+                        (y1 - y0 + 1 + 2 * tile_ring) * tile_extent));
+
+  bool result = false;
+  if (!prepare_draw(area)) {
+    invalidate_tiles();
+    c->set_matrix(m * c->get_matrix());
+    result = zoomed_draw(c);
+    if (overlay_draw) {
+      overlay_draw(c);
+    }
+    unset_changed();
+    return result;
+  }
+  // only the tiles in the part of the window being redrawn
+  double cx0, cy0, cx1, cy1;
+  c->get_clip_extents(cx0, cy0, cx1, cy1);
+  Rectangle clip(Point(cx0, cy0), Extent(cx1 - cx0, cy1 - cy0));
+  user_to_image(clip);
+  int64_t clip_x0, clip_y0, clip_x1, clip_y1;
+  tile_range(clip, clip_x0, clip_y0, clip_x1, clip_y1);
+  auto missing = draw_tiles(c, level, max(x0, clip_x0), max(y0, clip_y0),
+                            min(x1, clip_x1), min(y1, clip_y1));
+  if (!missing.empty()) {
+    // drawn straight to the window until the tile worker has them
+    c->save();
+    for (auto &&key : missing) {
+      // on the pixels paint_tile would put the tile
+      Point low = get_matrix_transform(m, get<1>(key) * tile_extent,
+                                       get<2>(key) * tile_extent);
+      Point high = get_matrix_transform(m, (get<1>(key) + 1) * tile_extent,
+                                        (get<2>(key) + 1) * tile_extent);
+      c->rectangle(round(low.x), round(low.y), round(high.x) - round(low.x),
+                   round(high.y) - round(low.y));
+    }
+    c->clip();
+    c->set_matrix(m * c->get_matrix());
+    result = zoomed_draw(c);
+    c->restore();
+  }
+  if (overlay_draw) {
+    c->save();
+    c->set_matrix(m * c->get_matrix());
+    overlay_draw(c);
+    c->restore();
+  }
+  // an item being dragged would change them on every motion
+  if (snapshot_draw && !what_to_drag_) {
+    request_tiles(level, x0, y0, x1, y1);
+  }
   unset_changed();
   return result;
 }
 
+/*
+ * Paints the tiles there are, and returns the ones missing.  Without
+ * snapshot_draw none are missing, they are rendered here.
+ */
+vector<TileKey> DrawingArea_ZoomDrag::draw_tiles(CContext c, int level,
+                                                 int64_t x0, int64_t y0,
+                                                 int64_t x1, int64_t y1) {
+  vector<TileKey> missing;
+  ++frame_;
+  for (int64_t x = x0; x <= x1; ++x) {
+    for (int64_t y = y0; y <= y1; ++y) {
+      TileKey key(level, x, y);
+      auto tile = tiles_.find(key);
+      if (tile == tiles_.end()) {
+        if (snapshot_draw) {
+          missing.push_back(key);
+          continue;
+        }
+        tile = tiles_.emplace(key, Tile{render_tile(zoomed_draw, key), 0})
+                   .first;
+      }
+      tile->second.last_drawn = frame_;
+      paint_tile(c, key, tile->second);
+    }
+  }
+  evict_tiles();
+  return missing;
+}
+
+void DrawingArea_ZoomDrag::paint_tile(CContext c, const TileKey &key,
+                                      const Tile &tile) {
+  double scale = get_scale_from_matrix(m);
+  double tile_scale = pow(zoom_factor, get<0>(key));
+  double tile_extent = tile_size / tile_scale;
+  // tiles go on whole pixels, so they are copied without resampling when the
+  // scale is the level's
+  Point origin = get_matrix_transform(m, get<1>(key) * tile_extent,
+                                      get<2>(key) * tile_extent);
+  c->save();
+  c->translate(round(origin.x), round(origin.y));
+  c->scale(scale / tile_scale, scale / tile_scale);
+  c->set_source(tile.surface, 0, 0);
+  c->paint();
+  c->restore();
+}
+
+/*
+ * Asks the tile worker for the missing tiles in view, then the ones in the
+ * ring around it.  Requests for other tiles are dropped, the ones still
+ * wanted keep their job, so a tile being rendered isn't started again.
+ */
+void DrawingArea_ZoomDrag::request_tiles(int level, int64_t x0, int64_t y0,
+                                         int64_t x1, int64_t y1) {
+  map<TileKey, TileWorker::Job> requested;
+  vector<TileWorker::Job> jobs;
+  auto request = [&](int64_t x, int64_t y) {
+    TileKey key(level, x, y);
+    if (tiles_.count(key) || requested.count(key)) {
+      return;
+    }
+    auto old = requested_.find(key);
+    if (old != requested_.end()) {
+      jobs.push_back(old->second);
+    } else {
+      // one snapshot for all the tiles until the image changes
+      if (!snapshot_ || snapshot_version_ != image_version_) {
+        snapshot_ = make_shared<const TileWorker::Draw>(snapshot_draw());
+        snapshot_version_ = image_version_;
+      }
+      jobs.push_back(TileWorker::Job{key, ++last_request_, snapshot_});
+    }
+    requested.emplace(key, jobs.back());
+  };
+  for (int64_t x = x0; x <= x1; ++x) {
+    for (int64_t y = y0; y <= y1; ++y) {
+      request(x, y);
+    }
+  }
+  for (int64_t x = x0 - tile_ring; x <= x1 + tile_ring; ++x) {
+    for (int64_t y = y0 - tile_ring; y <= y1 + tile_ring; ++y) {
+      request(x, y);
+    }
+  }
+  if (jobs.empty() && requested_.empty()) {
+    return;
+  }
+  requested_.swap(requested);
+  tile_worker_.run(move(jobs));
+}
+
+void DrawingArea_ZoomDrag::tile_rendered(
+    const TileWorker::Job &job, Cairo::RefPtr<Cairo::ImageSurface> surface) {
+  // not if the tile changed since the request
+  auto request = requested_.find(job.key);
+  if (request == requested_.end() || request->second.id != job.id) {
+    return;
+  }
+  requested_.erase(request);
+  tiles_[job.key] = Tile{move(surface), frame_};
+  int level = int(lround(log(get_scale_from_matrix(m)) / log(zoom_factor)));
+  if (get<0>(job.key) == level) {
+    double tile_extent = tile_size / pow(zoom_factor, level);
+    queue_draw_window_area(Rectangle(
+        Point(get<1>(job.key) * tile_extent, get<2>(job.key) * tile_extent),
+        Extent(tile_extent, tile_extent)));
+  }
+}
+
+// drops the least recently drawn tiles past max_tiles, but none in view
+void DrawingArea_ZoomDrag::evict_tiles() {
+  while (tiles_.size() > max_tiles) {
+    auto oldest = tiles_.begin();
+    for (auto tile = tiles_.begin(); tile != tiles_.end(); ++tile) {
+      if (tile->second.last_drawn < oldest->second.last_drawn) {
+        oldest = tile;
+      }
+    }
+    if (oldest->second.last_drawn == frame_) {
+      return;
+    }
+    tiles_.erase(oldest);
+  }
+}
+
+// what changes the tile, with a pixel around it for the antialiasing of what
+// is next to it
+static Rectangle tile_reach(const TileKey &key) {
+  double pixel = 1 / pow(zoom_factor, get<0>(key));
+  double tile_extent = tile_size * pixel;
+  return Rectangle(Point(get<1>(key) * tile_extent - pixel,
+                         get<2>(key) * tile_extent - pixel),
+                   Extent(tile_extent + 2 * pixel, tile_extent + 2 * pixel));
+}
+
+void DrawingArea_ZoomDrag::invalidate_tiles(const Rectangle &area) {
+  for (auto tile = tiles_.begin(); tile != tiles_.end();) {
+    if (tile_reach(tile->first).Overlaps(area)) {
+      tile = tiles_.erase(tile);
+    } else {
+      ++tile;
+    }
+  }
+  ++image_version_;
+  // a tile being rendered is dropped when it comes back
+  for (auto request = requested_.begin(); request != requested_.end();) {
+    if (tile_reach(request->first).Overlaps(area)) {
+      request = requested_.erase(request);
+    } else {
+      ++request;
+    }
+  }
+}
+
+void DrawingArea_ZoomDrag::invalidate_tiles() {
+  ++image_version_;
+  tiles_.clear();
+  requested_.clear();
+}
+
+void DrawingArea_ZoomDrag::queue_draw_image_area(const Rectangle &area) {
+  invalidate_tiles(area);
+  queue_draw_window_area(area);
+}
+
+void DrawingArea_ZoomDrag::queue_draw_window_area(const Rectangle &area) {
+  // in window pixels, rounded out, with a pixel of antialiasing around,
+  Point low = get_matrix_transform(m, area.position.x, area.position.y);
+  Point high = get_matrix_transform(m, area.position.x + area.extent.x,
+                                    area.position.y + area.extent.y);
+  // and cut to the window, far off areas don't fit in an int
+  double x0 = max(floor(low.x) - 1, 0.0);
+  double y0 = max(floor(low.y) - 1, 0.0);
+  double x1 = min(ceil(high.x) + 1, double(get_width()));
+  double y1 = min(ceil(high.y) + 1, double(get_height()));
+  if (x0 < x1 && y0 < y1) {
+    queue_draw_area(int(x0), int(y0), int(x1 - x0), int(y1 - y0));
+  }
+}
+
 bool DrawingArea_ZoomDrag::on_scroll_event(GdkEventScroll *e) {
   double this_zoom_factor;
   if (e->direction == GDK_SCROLL_UP) {
@@ -137,6 +484,10 @@ void DrawingArea_ZoomDrag::user_to_image(Rectangle &rectangle) const {
   user_to_image_scale(rectangle.extent);
 }
 
+double DrawingArea_ZoomDrag::get_scale() const {
+  return get_scale_from_matrix(m);
+}
+
 bool DrawingArea_ZoomDrag::changed() const { return change_since_last_draw_; }
 
 void DrawingArea_ZoomDrag::translate_item(Point &item, Point translate) {
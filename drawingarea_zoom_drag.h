@@ -6,25 +6,107 @@
 #include <gtkmm-3.0/gtkmm/drawingarea.h>
 
 #include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
 //#include <iostream>
 
 using CContext = const Cairo::RefPtr<Cairo::Context> &;
 using DragTarget = std::shared_ptr<Rectangle>;
 using PLayout = Glib::RefPtr<Pango::Layout>;
+// zoom level, x, y in tiles from the image origin
+using TileKey = std::tuple<int, int64_t, int64_t>;
+
+/*
+ * Renders tiles on threads of its own.  Each job draws with a function that
+ * only reads its own copy of what it draws, so it can run while the GTK
+ * thread changes the original.  run replaces the jobs that haven't started
+ * yet, and the rendered tiles are handed to done on the GTK thread (through a
+ * Glib::Dispatcher).  Construct it after Gtk::Application::create.
+ */
+class TileWorker {
+public:
+  using Draw = std::function<bool(CContext)>;
+  struct Job {
+    TileKey key;
+    uint64_t id;
+    std::shared_ptr<const Draw> draw;
+  };
+  using Done =
+      std::function<void(const Job &, Cairo::RefPtr<Cairo::ImageSurface>)>;
+
+  explicit TileWorker(Done done);
+  TileWorker(const TileWorker &) = delete;
+  TileWorker &operator=(const TileWorker &) = delete;
+  ~TileWorker();
+
+  // the jobs are done in order, except the ones already running
+  void run(std::vector<Job> jobs);
+
+private:
+  struct Finished {
+    Job job;
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+  };
+
+  void work();
+  void deliver();
+
+  Done done_;
+  Glib::Dispatcher dispatcher_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<Job> pending_;
+  std::unordered_set<uint64_t> running_; // job ids
+  std::vector<Finished> finished_;       // waiting for the GTK thread
+  bool stop_;
+  std::vector<std::thread> threads_;
+};
 
 /*
  * DrawingArea_ZoomDrag is a drawing area which handles some zooming and
  * dragging in
  * response to motion events
+ *
+ * What zoomed_draw draws is kept in tiles: images tile_size pixels square,
+ * rendered at the zoom level's scale, so that panning only paints tiles that
+ * are already rendered and only the tiles coming into view are drawn.  The
+ * zoom levels are the steps of the scroll wheel, the tiles of the last few
+ * levels stay around for zooming back.  Whoever changes the image tells which
+ * part of it changed with invalidate_tiles.
+ *
+ * With snapshot_draw set, the tiles in view and the ring around them are
+ * rendered on a TileWorker; until they come back, what they cover is drawn
+ * straight to the window with zoomed_draw.  The snapshot is taken again only
+ * after the image changed.
  */
 class DrawingArea_ZoomDrag : public Gtk::DrawingArea {
+  struct Tile {
+    Cairo::RefPtr<Cairo::ImageSurface> surface;
+    uint64_t last_drawn; // frame
+  };
+
   Cairo::Matrix m;
   bool drag_;
   bool change_since_last_draw_;
   Point last_pos_;
   DragTarget what_to_drag_;
+  std::map<TileKey, Tile> tiles_;
+  uint64_t frame_;
+  std::map<TileKey, TileWorker::Job> requested_; // from the tile worker
+  uint64_t last_request_;
+  uint64_t image_version_; // changes when tiles are invalidated
+  std::shared_ptr<const TileWorker::Draw> snapshot_;
+  uint64_t snapshot_version_; // image_version_ when snapshot_ was taken
+  TileWorker tile_worker_;
 
 public:
   /*
@@ -32,6 +114,46 @@ public:
    * zooming tranformations.
    */
   std::function<bool(CContext)> zoomed_draw;
+  /*
+   * Called once at the start of every draw with the part of the image (in
+   * image space) about to be drawn.  Returns whether the drawing can be kept
+   * in tiles, return false while the image changes on every frame (e.g.
+   * during an animation): then the tiles are dropped and zoomed_draw draws
+   * straight to the window.
+   */
+  std::function<bool(const Rectangle &)> prepare_draw;
+  /*
+   * Called on the GTK thread when there are tiles to render and the image
+   * changed since the last call, returns a function that draws the image as
+   * it is now (like zoomed_draw) from a copy of its own, on tile worker
+   * threads.  When it's not set the tiles are rendered on the GTK thread.
+   */
+  std::function<TileWorker::Draw()> snapshot_draw;
+  /*
+   * Draws over the image (in image space, like zoomed_draw) on every draw,
+   * and is never kept in the tiles: for what changes often and is quick to
+   * draw, e.g. a shade on the node under the pointer.
+   */
+  std::function<void(CContext)> overlay_draw;
+  // drops the tiles overlapping the area, in image space
+  void invalidate_tiles(const Rectangle &area);
+  /*
+   * For when the image changed in the area (in image space): drops its tiles
+   * and redraws only that part of the window
+   */
+  void queue_draw_image_area(const Rectangle &area);
+  // drops all the tiles
+  void invalidate_tiles();
+  /*
+   * For when what snapshot_draw copies changed but the image didn't (e.g. it
+   * copies less than the whole image): the next tiles use a new snapshot
+   */
+  void invalidate_snapshot() { ++image_version_; }
+  /*
+   * Redraws the part of the window showing the area (in image space) and
+   * keeps the tiles, for when only the overlay changed there
+   */
+  void queue_draw_window_area(const Rectangle &area);
   /*
    * This call back sets the field what_to_drag.
    *
@@ -48,6 +170,8 @@ public:
   void user_to_image(Point&) const;
   void user_to_image_scale(Extent&) const;
   void user_to_image(Rectangle&) const;
+  // how many pixels one unit of the image takes up
+  double get_scale() const;
   /*
    * Used to inform the user if the matrix has changed since the last draw
    */
@@ -66,6 +190,14 @@ protected:
   bool on_scroll_event(GdkEventScroll *e) override;
 
 private:
+  std::vector<TileKey> draw_tiles(CContext c, int level, int64_t x0,
+                                  int64_t y0, int64_t x1, int64_t y1);
+  void paint_tile(CContext c, const TileKey &key, const Tile &tile);
+  void request_tiles(int level, int64_t x0, int64_t y0, int64_t x1,
+                     int64_t y1);
+  void tile_rendered(const TileWorker::Job &job,
+                     Cairo::RefPtr<Cairo::ImageSurface> surface);
+  void evict_tiles();
   void translate_matrix(Point);
   //translates item by translate scaled by the matrices current scale factor
   void translate_item(Point& item, Point translate);
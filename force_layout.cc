@@ -0,0 +1,414 @@
+// force_layout.cc
+
+#include "force_layout.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const uint32_t no_vertex = UINT32_MAX;
+static const int32_t no_cell = -1;
+// below this size cells are not split, coincident boxes share a leaf
+static const int max_depth = 48;
+// pulls everything towards the middle so separate components don't drift off
+static const double gravity = 0.1;
+// the temperature (largest move in one iteration) ends at this many times the
+// ideal edge length
+static const double final_temperature = 0.01;
+
+/*
+ * A Barnes-Hut quadtree over the vertex positions.  Each cell has the total
+ * mass and center of mass of the vertices in it; a leaf holds one vertex,
+ * or several that are (nearly) on top of each other.  The four children of a
+ * cell are allocated together, empty ones have no mass.
+ */
+class QuadTree {
+  // plain doubles rather than Points, the Point operators are not inline
+  struct Cell {
+    double x, y; // center of mass, a weighted sum until build finishes
+    double mass;
+    double size;
+    int32_t children; // the first of the four, no_cell for a leaf
+    uint32_t body;
+  };
+  vector<Cell> cells_;
+
+  void add_cells(size_t count, double size) {
+    cells_.resize(cells_.size() + count, {0, 0, 0, size, no_cell, no_vertex});
+  }
+
+public:
+  void build(const vector<Point> &position, const vector<uint32_t> &order);
+  Point repulsion(const vector<Point> &position, uint32_t v, double k2,
+                  double theta2, vector<int32_t> &stack) const;
+};
+
+/*
+ * Inserting the vertices in spatial order keeps the cells of a neighborhood
+ * close together in memory
+ */
+void QuadTree::build(const vector<Point> &position,
+                     const vector<uint32_t> &order) {
+  cells_.clear();
+  if (position.empty()) {
+    return;
+  }
+  Point low = position[0];
+  Point high = position[0];
+  for (auto &&p : position) {
+    low.x = min(low.x, p.x);
+    low.y = min(low.y, p.y);
+    high.x = max(high.x, p.x);
+    high.y = max(high.y, p.y);
+  }
+  // a little larger, so that the high edge falls inside
+  double root_size = max(max(high.x - low.x, high.y - low.y), 1.0) * 1.001;
+  add_cells(1, root_size);
+
+  for (auto v : order) {
+    const Point &p = position[v];
+    int32_t cell = 0;
+    Point corner = low;
+    double size = root_size;
+    for (int depth = 0;; ++depth) {
+      cells_[cell].mass += 1;
+      cells_[cell].x += p.x;
+      cells_[cell].y += p.y;
+      if (cells_[cell].children == no_cell) {
+        if (cells_[cell].mass == 1) {
+          cells_[cell].body = v;
+          break;
+        }
+        if (depth == max_depth) {
+          break;
+        }
+        // split the leaf, its vertex moves down a level
+        uint32_t body = cells_[cell].body;
+        cells_[cell].body = no_vertex;
+        cells_[cell].children = cells_.size();
+        add_cells(4, size / 2);
+        const Point &q = position[body];
+        int32_t moved = cells_[cell].children +
+                        (q.x >= corner.x + size / 2) +
+                        2 * (q.y >= corner.y + size / 2);
+        cells_[moved].mass = 1;
+        cells_[moved].x = q.x;
+        cells_[moved].y = q.y;
+        cells_[moved].body = body;
+      }
+      size /= 2;
+      int quadrant = 0;
+      if (p.x >= corner.x + size) {
+        quadrant |= 1;
+        corner.x += size;
+      }
+      if (p.y >= corner.y + size) {
+        quadrant |= 2;
+        corner.y += size;
+      }
+      cell = cells_[cell].children + quadrant;
+    }
+  }
+  for (auto &&cell : cells_) {
+    if (cell.mass) {
+      cell.x /= cell.mass;
+      cell.y /= cell.mass;
+    }
+  }
+}
+
+/*
+ * The push on v from all the other vertices, k2 / distance in size.  Cells
+ * far enough away compared to their size are taken as one body at their
+ * center of mass.
+ */
+Point QuadTree::repulsion(const vector<Point> &position, uint32_t v,
+                          double k2, double theta2,
+                          vector<int32_t> &stack) const {
+  double fx = 0;
+  double fy = 0;
+  double px = position[v].x;
+  double py = position[v].y;
+  stack.clear();
+  if (!cells_.empty()) {
+    stack.push_back(0);
+  }
+  while (!stack.empty()) {
+    const Cell &cell = cells_[stack.back()];
+    stack.pop_back();
+    double dx = px - cell.x;
+    double dy = py - cell.y;
+    double d2 = dx * dx + dy * dy;
+    if (cell.children == no_cell || cell.size * cell.size < theta2 * d2) {
+      // d2 is 0 for the leaf of v itself
+      if (d2 > 0) {
+        double f = k2 * cell.mass / d2;
+        fx += f * dx;
+        fy += f * dy;
+      }
+      continue;
+    }
+    for (int32_t child = cell.children; child < cell.children + 4; ++child) {
+      if (cells_[child].mass) {
+        stack.push_back(child);
+      }
+    }
+  }
+  return Point(fx, fy);
+}
+
+/*
+ * The vertices sorted along a Z-order curve, so that vertices close in the
+ * order are close on the plane.  Walking the tree for them one after the
+ * other then hits the same cells, which is what makes it fast.
+ */
+static void spatial_order(const vector<Point> &position,
+                          vector<uint32_t> &order) {
+  Point low = position[0];
+  Point high = position[0];
+  for (auto &&p : position) {
+    low.x = min(low.x, p.x);
+    low.y = min(low.y, p.y);
+    high.x = max(high.x, p.x);
+    high.y = max(high.y, p.y);
+  }
+  double scale = 65535 / max(max(high.x - low.x, high.y - low.y), 1.0);
+  auto spread = [](uint32_t x) {
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    return (x | (x << 1)) & 0x55555555;
+  };
+  vector<pair<uint32_t, uint32_t>> keyed(position.size());
+  for (uint32_t v = 0; v < position.size(); ++v) {
+    uint32_t x = (position[v].x - low.x) * scale;
+    uint32_t y = (position[v].y - low.y) * scale;
+    keyed[v] = {spread(x) | (spread(y) << 1), v};
+  }
+  sort(keyed.begin(), keyed.end());
+  order.resize(position.size());
+  for (size_t i = 0; i < keyed.size(); ++i) {
+    order[i] = keyed[i].second;
+  }
+}
+
+/*
+ * With nothing to start from, the vertices are numbered breadth first from
+ * the roots and laid along a Z-order curve in that order, one per k sized
+ * square.  Callers and callees start close to each other, so there is much
+ * less to untangle than from random positions.
+ */
+static void initial_positions(const View &view,
+                              const vector<uint32_t> &vertex_of,
+                              const vector<size_t> &offsets,
+                              const vector<uint32_t> &neighbors, double k,
+                              vector<Point> &position) {
+  uint32_t n = position.size();
+  vector<uint32_t> queue;
+  queue.reserve(n);
+  vector<bool> queued(n, false);
+  auto bfs = [&](uint32_t start) {
+    if (start == no_vertex || queued[start]) {
+      return;
+    }
+    queued[start] = true;
+    queue.push_back(start);
+    for (size_t i = queue.size() - 1; i < queue.size(); ++i) {
+      uint32_t v = queue[i];
+      for (size_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+        if (!queued[neighbors[j]]) {
+          queued[neighbors[j]] = true;
+          queue.push_back(neighbors[j]);
+        }
+      }
+    }
+  };
+  for (auto root : view.roots) {
+    bfs(vertex_of[root->id]);
+  }
+  for (uint32_t v = 0; v < n; ++v) {
+    bfs(v);
+  }
+  auto compact = [](uint32_t x) {
+    x &= 0x55555555;
+    x = (x | (x >> 1)) & 0x33333333;
+    x = (x | (x >> 2)) & 0x0f0f0f0f;
+    x = (x | (x >> 4)) & 0x00ff00ff;
+    return (x | (x >> 8)) & 0x0000ffff;
+  };
+  for (uint32_t i = 0; i < n; ++i) {
+    position[queue[i]] = k * Point(compact(i), compact(i >> 1));
+  }
+}
+
+/*
+ * A reproducible offset in [-1, 1)^2 for vertex v, to pull apart boxes that
+ * start at the same place (the children of a node that was just expanded)
+ */
+static Point jitter(uint32_t v) {
+  uint64_t h = (v + 1) * 0x9e3779b97f4a7c15ull;
+  h ^= h >> 31;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 29;
+  return Point((h & 0xffff) / 32768.0 - 1, ((h >> 16) & 0xffff) / 32768.0 - 1);
+}
+
+void force_directed_layout(View &view, const ForceLayoutOptions &options) {
+  auto start = chrono::steady_clock::now();
+  // the boxes are moved behind the back of the incremental grid layout
+  view.grid.invalidate();
+  view.spatial_index.invalidate();
+  view.layout_moves.all = true;
+  vector<NodeBase *> nodes(view.logicalSubView.begin(),
+                           view.logicalSubView.end());
+  sort(nodes.begin(), nodes.end(),
+       [](NodeBase *a, NodeBase *b) { return a->id < b->id; });
+  size_t n = nodes.size();
+  if (!n) {
+    return;
+  }
+  vector<uint32_t> vertex_of(view.name_to_node->size(), no_vertex);
+  for (uint32_t v = 0; v < n; ++v) {
+    vertex_of[nodes[v]->id] = v;
+  }
+
+  // neighbors in both directions, as one array
+  vector<size_t> offsets(n + 1, 0);
+  vector<uint32_t> neighbors;
+  for (uint32_t v = 0; v < n; ++v) {
+    for (auto edge : nodes[v]->neighborhood.outgoing) {
+      uint32_t u = vertex_of[edge->head->id];
+      if (u != no_vertex && u != v) {
+        neighbors.push_back(u);
+      }
+    }
+    for (auto edge : nodes[v]->neighborhood.incoming) {
+      uint32_t u = vertex_of[edge->tail->id];
+      if (u != no_vertex && u != v) {
+        neighbors.push_back(u);
+      }
+    }
+    offsets[v + 1] = neighbors.size();
+  }
+
+  // the ideal edge length: about a box and some spacing
+  vector<Extent> extent(n);
+  double k = 0;
+  for (uint32_t v = 0; v < n; ++v) {
+    extent[v] = view.viewData.at(nodes[v]).box->extent;
+    k += extent[v].x;
+  }
+  k = k / n + view.column_spacing;
+
+  vector<Point> position(n);
+  Point low = Point::infinity();
+  Point high = -1 * Point::infinity();
+  for (uint32_t v = 0; v < n; ++v) {
+    const Rectangle &box = *view.viewData.at(nodes[v]).box;
+    position[v] = box.position + extent[v] / 2;
+    low.x = min(low.x, position[v].x);
+    low.y = min(low.y, position[v].y);
+    high.x = max(high.x, position[v].x);
+    high.y = max(high.y, position[v].y);
+  }
+  Point spread = high - low;
+  if (sqrt(spread * spread) < k * sqrt(n)) {
+    initial_positions(view, vertex_of, offsets, neighbors, k, position);
+  } else {
+    for (uint32_t v = 0; v < n; ++v) {
+      position[v] += (k / 10) * jitter(v);
+    }
+  }
+
+  unsigned threads = options.threads ? options.threads
+                                     : max(1u, thread::hardware_concurrency());
+  threads = min<size_t>(threads, (n + 1023) / 1024);
+  double temperature = k * sqrt(n) / 10;
+  double cooling = 0.95;
+  double k2 = k * k;
+  double theta2 = options.theta * options.theta;
+  QuadTree tree;
+  vector<Point> displacement(n);
+
+  vector<uint32_t> order;
+  auto forces = [&](uint32_t begin, uint32_t end) {
+    vector<int32_t> stack;
+    for (uint32_t i = begin; i < end; ++i) {
+      uint32_t v = order[i];
+      Point force = tree.repulsion(position, v, k2, theta2, stack);
+      for (size_t j = offsets[v]; j < offsets[v + 1]; ++j) {
+        Point d = position[neighbors[j]] - position[v];
+        force += (sqrt(d * d) / k) * d;
+      }
+      force -= gravity * position[v];
+      displacement[v] = force;
+    }
+  };
+
+  for (int iteration = 0; iteration < options.max_iterations; ++iteration) {
+    if (options.cancel && *options.cancel) {
+      return;
+    }
+    // keep the middle at the origin, that is where gravity pulls
+    Point mean;
+    for (auto &&p : position) {
+      mean += p;
+    }
+    mean /= n;
+    for (auto &&p : position) {
+      p -= mean;
+    }
+
+    spatial_order(position, order);
+    tree.build(position, order);
+    vector<thread> workers;
+    for (unsigned t = 1; t < threads; ++t) {
+      workers.emplace_back(forces, n * t / threads, n * (t + 1) / threads);
+    }
+    forces(0, n / threads);
+    for (auto &&worker : workers) {
+      worker.join();
+    }
+    for (uint32_t v = 0; v < n; ++v) {
+      double length = sqrt(displacement[v] * displacement[v]);
+      if (length > temperature) {
+        displacement[v] *= temperature / length;
+      }
+      position[v] += displacement[v];
+    }
+
+    double elapsed =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (elapsed >= options.time_budget) {
+      break;
+    }
+    if (iteration == 0) {
+      // spread the cooling over the iterations that fit in the budget
+      double planned = min<double>(options.max_iterations,
+                                   options.time_budget / elapsed);
+      cooling = pow(final_temperature * k / temperature,
+                    1 / max(planned - 1, 1.0));
+    }
+    temperature *= cooling;
+  }
+
+  // top left at the origin, like the other layouts
+  low = Point::infinity();
+  for (uint32_t v = 0; v < n; ++v) {
+    position[v] -= extent[v] / 2;
+    low.x = min(low.x, position[v].x);
+    low.y = min(low.y, position[v].y);
+  }
+  for (uint32_t v = 0; v < n; ++v) {
+    view.viewData.at(nodes[v]).box->position = position[v] - low;
+  }
+}
+
+void force_directed_layout(View &view) {
+  force_directed_layout(view, ForceLayoutOptions());
+}
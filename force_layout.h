@@ -0,0 +1,32 @@
+// force_layout.h
+#pragma once
+
+#include "view.h"
+
+#include <atomic>
+
+/*
+ * force_directed_layout lays out the logicalSubView like a physical system:
+ * calls pull the boxes together like springs, and all boxes push each other
+ * apart.  The pushing is approximated with a Barnes-Hut quadtree, so an
+ * iteration is O(n log n), and the forces are computed on several threads.
+ * It starts from the current positions (so it can refine another layout),
+ * unless they are all on top of each other.
+ */
+struct ForceLayoutOptions {
+  double time_budget;  // seconds, the layout stops early when it is used up
+  unsigned threads;    // 0 for one per core
+  int max_iterations;
+  double theta;        // cells smaller than theta times their distance are
+                       // taken as a single body
+  // when set, the layout gives up and leaves the view as it was
+  const std::atomic<bool> *cancel;
+
+  ForceLayoutOptions()
+      : time_budget(3.0), threads(0), max_iterations(300), theta(1.0),
+        cancel(nullptr) {}
+};
+
+void force_directed_layout(View &view, const ForceLayoutOptions &options);
+// with the default options, usable as a LayoutAlgorithm
+void force_directed_layout(View &view);
@@ -193,30 +193,24 @@ LineSegment Rectangle::Top() const {
   return LineSegment(position, position + Point(extent.x, 0));
 }
 
-std::list<Point> Rectangle::Intersection(const Line &line) const {
-  std::list<Point> result;
-  auto top = Top();
-  auto bottom = Bottom();
-  auto left = Left();
-  auto right = Right();
-  if (top.Intersects(line))
-    result.push_back(top.Intersection(line));
-  if (bottom.Intersects(line))
-    result.push_back(bottom.Intersection(line));
-  if (left.Intersects(line))
-    result.push_back(left.Intersection(line));
-  if (right.Intersects(line))
-    result.push_back(right.Intersection(line));
-
-  result.sort();
-  result.unique();
+Intersections Rectangle::Intersection(const Line &line) const {
+  Intersections result;
+  LineSegment sides[] = {Top(), Bottom(), Left(), Right()};
+  for (auto &side : sides) {
+    if (side.Intersects(line)) {
+      result.insert(side.Intersection(line));
+    }
+  }
   return result;
 }
 
-std::list<Point> Rectangle::Intersection(const LineSegment &lineSegment) const {
-  auto result = Intersection((Line)lineSegment);
-  result.remove_if(
-      [&lineSegment](const Point &p) { return !lineSegment.Contains(p); });
+Intersections Rectangle::Intersection(const LineSegment &lineSegment) const {
+  Intersections result;
+  for (auto &&p : Intersection((Line)lineSegment)) {
+    if (lineSegment.Contains(p)) {
+      result.insert(p);
+    }
+  }
   return result;
 }
 
@@ -259,3 +253,155 @@ std::ostream &operator<<(std::ostream &o, const Rectangle &rectangle) {
   o << "{" << rectangle.position << ", " << rectangle.extent << "}";
   return o;
 }
+
+/// Intersections
+
+void Intersections::insert(const Point &p) {
+  for (size_t i = 0; i < count; ++i) {
+    if (abs(points[i].x - p.x) < accuracy_buffer &&
+        abs(points[i].y - p.y) < accuracy_buffer) {
+      return;
+    }
+  }
+  // a line only crosses a border twice, more is rounding at a corner
+  if (count == 2) {
+    return;
+  }
+  points[count++] = p;
+  if (count == 2 && points[1] < points[0]) {
+    std::swap(points[0], points[1]);
+  }
+}
+
+std::ostream &operator<<(std::ostream &o, const Intersections &intersections) {
+  o << "{";
+  for (size_t i = 0; i < intersections.size(); ++i) {
+    o << (i ? ", " : "") << intersections[i];
+  }
+  return o << "}";
+}
+
+/// Overlaps
+//
+// Written as selects rather than ifs so that the batched loops vectorize
+
+static inline bool boxes_overlap(double left, double top, double right,
+                                 double bottom, double x, double y,
+                                 double width, double height) {
+  return (left <= x + width) & (x <= right) & (top <= y + height) &
+         (y <= bottom);
+}
+
+/*
+ * Separating axes: the segment misses the box when their bounding boxes
+ * don't overlap, or when all four corners of the box are strictly on one side
+ * of the line through the segment.  No divisions, and a segment parallel to
+ * an axis (or a single point) needs no special case.
+ */
+static inline bool segment_overlaps(double left, double top, double right,
+                                    double bottom, double ux, double uy,
+                                    double vx, double vy) {
+  bool bounds = (min(ux, vx) <= right) & (left <= max(ux, vx)) &
+                (min(uy, vy) <= bottom) & (top <= max(uy, vy));
+  // the cross product of v - u with corner - u, over the corners
+  double dx = vx - ux;
+  double dy = vy - uy;
+  double at_top = dx * (top - uy), at_bottom = dx * (bottom - uy);
+  double at_left = dy * (left - ux), at_right = dy * (right - ux);
+  double low = min(at_top, at_bottom) - max(at_left, at_right);
+  double high = max(at_top, at_bottom) - min(at_left, at_right);
+  return bounds & (low <= 0) & (0 <= high);
+}
+
+bool Rectangle::Overlaps(const LineSegment &lineSegment) const {
+  return segment_overlaps(position.x, position.y, position.x + extent.x,
+                          position.y + extent.y, lineSegment.u.x,
+                          lineSegment.u.y, lineSegment.v.x, lineSegment.v.y);
+}
+
+bool Rectangle::Overlaps(const Rectangle &rectangle) const {
+  return boxes_overlap(position.x, position.y, position.x + extent.x,
+                       position.y + extent.y, rectangle.position.x,
+                       rectangle.position.y, rectangle.extent.x,
+                       rectangle.extent.y);
+}
+
+void Rectangles::push_back(const Rectangle &rectangle) {
+  x.push_back(rectangle.position.x);
+  y.push_back(rectangle.position.y);
+  width.push_back(rectangle.extent.x);
+  height.push_back(rectangle.extent.y);
+}
+
+void Rectangles::remove(size_t i) {
+  x[i] = x.back();
+  y[i] = y.back();
+  width[i] = width.back();
+  height[i] = height.back();
+  x.pop_back();
+  y.pop_back();
+  width.pop_back();
+  height.pop_back();
+}
+
+void Rectangles::clear() {
+  x.clear();
+  y.clear();
+  width.clear();
+  height.clear();
+}
+
+void LineSegments::push_back(const LineSegment &lineSegment) {
+  ux.push_back(lineSegment.u.x);
+  uy.push_back(lineSegment.u.y);
+  vx.push_back(lineSegment.v.x);
+  vy.push_back(lineSegment.v.y);
+}
+
+void LineSegments::remove(size_t i) {
+  ux[i] = ux.back();
+  uy[i] = uy.back();
+  vx[i] = vx.back();
+  vy[i] = vy.back();
+  ux.pop_back();
+  uy.pop_back();
+  vx.pop_back();
+  vy.pop_back();
+}
+
+void LineSegments::clear() {
+  ux.clear();
+  uy.clear();
+  vx.clear();
+  vy.clear();
+}
+
+void overlaps(const Rectangle &rectangle, const Rectangles &batch,
+              uint8_t *mask) {
+  const double left = rectangle.position.x;
+  const double top = rectangle.position.y;
+  const double right = left + rectangle.extent.x;
+  const double bottom = top + rectangle.extent.y;
+  const double *x = batch.x.data(), *y = batch.y.data();
+  const double *width = batch.width.data(), *height = batch.height.data();
+  size_t n = batch.size();
+  for (size_t i = 0; i < n; ++i) {
+    mask[i] = boxes_overlap(left, top, right, bottom, x[i], y[i], width[i],
+                            height[i]);
+  }
+}
+
+void overlaps(const Rectangle &rectangle, const LineSegments &batch,
+              uint8_t *mask) {
+  const double left = rectangle.position.x;
+  const double top = rectangle.position.y;
+  const double right = left + rectangle.extent.x;
+  const double bottom = top + rectangle.extent.y;
+  const double *ux = batch.ux.data(), *uy = batch.uy.data();
+  const double *vx = batch.vx.data(), *vy = batch.vy.data();
+  size_t n = batch.size();
+  for (size_t i = 0; i < n; ++i) {
+    mask[i] = segment_overlaps(left, top, right, bottom, ux[i], uy[i], vx[i],
+                               vy[i]);
+  }
+}
@@ -1,8 +1,9 @@
 // geometry.h
 #pragma once
 
+#include <cstdint>
 #include <iostream>
-#include <list>
+#include <vector>
 
 struct Point;
 using Direction = Point;
@@ -91,6 +92,27 @@ struct LineSegment {
 
 std::ostream &operator<<(std::ostream &o, const LineSegment &lineSegment);
 
+/*
+ * Where a line or a segment meets the border of a rectangle: at most two
+ * points, held inline so that clipping never allocates.  They are kept sorted
+ * (by operator<) and nearly equal points (a corner hit through two sides)
+ * count once.
+ */
+struct Intersections {
+  Point points[2];
+  size_t count;
+
+  Intersections() : count(0) {}
+  const Point *begin() const { return points; }
+  const Point *end() const { return points + count; }
+  size_t size() const { return count; }
+  bool empty() const { return !count; }
+  const Point &operator[](size_t i) const { return points[i]; }
+  void insert(const Point &p);
+};
+
+std::ostream &operator<<(std::ostream &o, const Intersections &intersections);
+
 struct Rectangle {
   Point position; // upper left
   Extent extent;
@@ -107,8 +129,8 @@ struct Rectangle {
   LineSegment Bottom() const;
   LineSegment Top() const;
 
-  std::list<Point> Intersection(const Line &line) const;
-  std::list<Point> Intersection(const LineSegment &lineSegment) const;
+  Intersections Intersection(const Line &line) const;
+  Intersections Intersection(const LineSegment &lineSegment) const;
 
   bool Contains(const Point &p) const;
   bool Contains(const LineSegment &lineSegment) const;
@@ -116,7 +138,52 @@ struct Rectangle {
   bool Intersects(const Line &line) const;
   bool Intersects(const LineSegment &lineSegment) const;
   bool Intersects(const Rectangle &rectangle) const;
+
+  /*
+   * Whether any part of the other shape is in the rectangle (touching
+   * counts), exactly and without building segments.  Unlike Intersects, a
+   * segment need not cross a side.
+   */
+  bool Overlaps(const LineSegment &lineSegment) const;
+  bool Overlaps(const Rectangle &rectangle) const;
 };
 
 std::ostream &operator<<(std::ostream &o, const Rectangle &rectangle);
 
+/// Batches
+//
+// Many rectangles or segments as a structure of arrays.  The overlaps kernels
+// test them all against one rectangle with loops that have no branches, so
+// the compiler vectorizes them and culling runs at memory speed.
+struct Rectangles {
+  std::vector<double> x, y, width, height;
+
+  size_t size() const { return x.size(); }
+  Rectangle operator[](size_t i) const {
+    return Rectangle(Point(x[i], y[i]), Extent(width[i], height[i]));
+  }
+  void push_back(const Rectangle &rectangle);
+  // moves the last one to i
+  void remove(size_t i);
+  void clear();
+};
+
+struct LineSegments {
+  std::vector<double> ux, uy, vx, vy;
+
+  size_t size() const { return ux.size(); }
+  LineSegment operator[](size_t i) const {
+    return LineSegment(Point(ux[i], uy[i]), Point(vx[i], vy[i]));
+  }
+  void push_back(const LineSegment &lineSegment);
+  // moves the last one to i
+  void remove(size_t i);
+  void clear();
+};
+
+// mask[i] is 1 when rectangle.Overlaps(batch[i]), 0 otherwise
+void overlaps(const Rectangle &rectangle, const Rectangles &batch,
+              uint8_t *mask);
+void overlaps(const Rectangle &rectangle, const LineSegments &batch,
+              uint8_t *mask);
+
@@ -1,11 +1,21 @@
 // get_call_graph.cc
 
+#include "binary_graph.h"
+#include "tu_cache.h"
+
 #include <clang-c/CXCompilationDatabase.h>
 #include <clang-c/Index.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
@@ -79,22 +89,31 @@ ostream &operator<<(ostream &stream, const CXSourceLocation location) {
 }
 
 ostream &operator<<(ostream &stream, const CXSourceRange range) {
-  cout << clang_getRangeStart(range) << " "
-       << " " << clang_getRangeEnd(range);
+  stream << clang_getRangeStart(range) << " "
+         << " " << clang_getRangeEnd(range);
   return stream;
 }
 
-void printFullName(CXCursor c) {
+void printFullName(CXCursor c, ostream &o) {
   CXCursor parent = clang_getCursorSemanticParent(c);
   if (clang_getCursorKind(parent) != CXCursor_TranslationUnit &&
       !clang_Cursor_isNull(parent)) {
-    printFullName(parent);
-    cout << "::";
+    printFullName(parent, o);
+    o << "::";
   }
-  cout << clang_getCursorDisplayName(c);
+  o << clang_getCursorDisplayName(c);
 }
 
-int indent = 0;
+/*
+ * Everything visit needs to write out one translation unit.  Each worker owns
+ * its own, so TUs can be visited concurrently.
+ */
+struct VisitState {
+  ostream &o;
+  int indent;
+
+  VisitState(ostream &o) : o(o), indent(0) {}
+};
 
 bool spelling_is_null(CXCursor c) {
   bool result = false;
@@ -117,6 +136,8 @@ bool in_system_header(CXCursor c) {
  */
 CXChildVisitResult visit(CXCursor c, CXCursor parent,
                          CXClientData client_data) {
+  VisitState &state = *static_cast<VisitState *>(client_data);
+  ostream &o = state.o;
   CXCursorKind kind = clang_getCursorKind(c);
   bool indented = false;
 
@@ -125,13 +146,13 @@ CXChildVisitResult visit(CXCursor c, CXCursor parent,
        kind == CXCursor_FunctionDecl || kind == CXCursor_FunctionTemplate) &&
       //!in_system_header(c)) {
       clang_Location_isFromMainFile(clang_getCursorLocation(c))) {
-    cout << string(2 * indent, ' ');
-    cout << "$";
-    printFullName(c);
-    cout << "$";
-    cout << " " << clang_getCursorExtent(c) << endl;
+    o << string(2 * state.indent, ' ');
+    o << "$";
+    printFullName(c, o);
+    o << "$";
+    o << " " << clang_getCursorExtent(c) << "\n";
 
-    ++indent;
+    ++state.indent;
     indented = true;
   } else if (kind == CXCursor_CallExpr && !in_system_header(c)) {
     CXCursor ref = clang_getCursorReferenced(c);
@@ -141,58 +162,219 @@ CXChildVisitResult visit(CXCursor c, CXCursor parent,
       ref = generic;
 
     if (!spelling_is_null(ref)) {
-      cout << string(2 * indent, ' ') << "calls ";
-      cout << "$";
-      printFullName(ref);
-      cout << "$";
-      cout << " " << clang_getCursorExtent(c) << endl;
+      o << string(2 * state.indent, ' ') << "calls ";
+      o << "$";
+      printFullName(ref, o);
+      o << "$";
+      o << " " << clang_getCursorExtent(c) << "\n";
     }
   }
 
-  clang_visitChildren(c, visit, nullptr);
+  clang_visitChildren(c, visit, client_data);
 
   if (indented)
-    --indent;
+    --state.indent;
 
   return CXChildVisit_Continue;
 }
 
-int main(int argc, char *argv[]) {
-  if (argc > 2) {
-    fatal("usage: ./get_call_graph <directory containing "
-          "compile_commands.json>\n\tdefaults to the current directory\n\r");
+void collect_inclusion(CXFile included_file, CXSourceLocation *, unsigned,
+                       CXClientData client_data) {
+  ostringstream oss;
+  oss << clang_getFileName(included_file);
+  static_cast<vector<string> *>(client_data)->push_back(oss.str());
+}
+
+/*
+ * Parse a single translation unit and write its call graph records to o.  The
+ * files read while parsing (main file and headers) are put in dependencies.
+ * Returns false if clang could not parse the unit.
+ */
+bool extract_call_graph(CXIndex index, const vector<string> &command,
+                        ostream &o, vector<string> &dependencies) {
+  vector<const char *> c_str_command;
+  for (auto &&str : command) {
+    c_str_command.push_back(str.data());
   }
-  string directory = ".";
-  if (argc == 2) {
-    directory = argv[1];
+  CXTranslationUnit unit = clang_parseTranslationUnit(
+      index, nullptr, c_str_command.data(),
+      c_str_command.size(), // command_line_args, num_command_line_args
+      nullptr, 0,           // unsaved_files, num_unsaved_files
+      CXTranslationUnit_None);
+
+  if (!unit) {
+    return false;
   }
 
-  CXIndex index = clang_createIndex(0,  // excludeDeclarationsFromPCH
-                                    0); // displayDiagnostics
+  VisitState state(o);
+  CXCursor cursor = clang_getTranslationUnitCursor(unit);
+  clang_visitChildren(cursor, visit, &state);
+  clang_getInclusions(unit, collect_inclusion, &dependencies);
 
-  auto compile_commands = get_compile_commands_directory(directory);
+  clang_disposeTranslationUnit(unit);
+  return true;
+}
+
+/*
+ * Output of one translation unit, filled in by whichever worker parsed it.
+ */
+struct TUResult {
+  string output;
+  bool done;
+  bool ok;
+
+  TUResult() : done(false), ok(false) {}
+};
 
-  for (auto &&command : compile_commands) {
-    vector<const char *> c_str_command;
-    for (auto &&str : command) {
-      c_str_command.push_back(str.data());
+/*
+ * Workers take the next unparsed TU off a shared counter, each with its own
+ * CXIndex.  The main thread writes the results to cout in compilation database
+ * order as they become available, so the output does not depend on the number
+ * of jobs or on scheduling.
+ *
+ * With a cache, only the TUs whose entry is missing or stale are parsed.
+ */
+class ExtractionPool {
+  const vector<vector<string>> &commands_;
+  TUCache *cache_;
+  vector<TUResult> results_;
+  atomic<size_t> next_;
+  atomic<bool> stop_;
+  mutex mutex_;
+  condition_variable finished_;
+  vector<thread> workers_;
+
+  void work() {
+    CXIndex index = clang_createIndex(0,  // excludeDeclarationsFromPCH
+                                      0); // displayDiagnostics
+    for (size_t i = next_++; i < commands_.size() && !stop_; i = next_++) {
+      string output;
+      bool ok = true;
+      if (!cache_ || !cache_->load(commands_[i], output)) {
+        ostringstream oss;
+        vector<string> dependencies;
+        ok = extract_call_graph(index, commands_[i], oss, dependencies);
+        output = oss.str();
+        if (ok && cache_) {
+          cache_->store(commands_[i], dependencies, output);
+        }
+      }
+      {
+        lock_guard<mutex> lock(mutex_);
+        results_[i].output = move(output);
+        results_[i].ok = ok;
+        results_[i].done = true;
+      }
+      finished_.notify_all();
     }
-    CXTranslationUnit unit = clang_parseTranslationUnit(
-        index, nullptr, c_str_command.data(),
-        c_str_command.size(), // command_line_args, num_command_line_args
-        nullptr, 0,           // unsaved_files, num_unsaved_files
-        CXTranslationUnit_None);
-
-    if (!unit) {
-      cerr << "CXTranslationUnit: " << clang_getTranslationUnitSpelling(unit)
-           << endl;
-      fatal("parse failed");
+    clang_disposeIndex(index);
+  }
+
+public:
+  ExtractionPool(const vector<vector<string>> &commands, unsigned jobs,
+                 TUCache *cache)
+      : commands_(commands), cache_(cache), results_(commands.size()),
+        next_(0), stop_(false) {
+    for (unsigned i = 0; i < jobs; ++i) {
+      workers_.emplace_back(&ExtractionPool::work, this);
     }
+  }
+
+  /*
+   * Writes the TUs in order, returns the index of the first TU that failed to
+   * parse (or commands.size() if all succeeded)
+   */
+  size_t write_ordered(ostream &o) {
+    for (size_t i = 0; i < results_.size(); ++i) {
+      string output;
+      {
+        unique_lock<mutex> lock(mutex_);
+        finished_.wait(lock, [this, i]() { return results_[i].done; });
+        if (!results_[i].ok) {
+          stop_ = true;
+          return i;
+        }
+        output = move(results_[i].output);
+      }
+      o << output;
+    }
+    return results_.size();
+  }
+
+  ~ExtractionPool() {
+    stop_ = true;
+    for (auto &&worker : workers_) {
+      worker.join();
+    }
+  }
+};
+
+int usage() {
+  cerr << "usage: ./get_call_graph [-j jobs] [-c cache] [-b] [directory]\n"
+          "\tdirectory should contain compile_commands.json, defaults to the "
+          "current directory\n"
+          "\tjobs is the number of TUs to parse in parallel, defaults to 1\n"
+          "\tcache is a directory where the records of each TU are kept "
+          "between runs, only TUs whose sources changed are parsed again\n"
+          "\t-b writes the graph in the binary format instead of text"
+       << endl;
+  return -1;
+}
+
+int main(int argc, char *argv[]) {
+  string directory = ".";
+  string cache_directory;
+  unsigned jobs = 1;
+  bool binary = false;
+  bool have_directory = false;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (arg.compare(0, 2, "-j") == 0 && arg.size() > 2) {
+      jobs = atoi(arg.c_str() + 2);
+    } else if (arg == "-c" && i + 1 < argc) {
+      cache_directory = argv[++i];
+    } else if (arg == "-b") {
+      binary = true;
+    } else if (!have_directory && arg[0] != '-') {
+      directory = arg;
+      have_directory = true;
+    } else {
+      return usage();
+    }
+  }
+  if (jobs == 0) {
+    return usage();
+  }
 
-    CXCursor cursor = clang_getTranslationUnitCursor(unit);
-    clang_visitChildren(cursor, visit, nullptr);
+  auto compile_commands = get_compile_commands_directory(directory);
+  jobs = min<size_t>(jobs, max<size_t>(compile_commands.size(), 1));
 
-    clang_disposeTranslationUnit(unit);
+  unique_ptr<TUCache> cache;
+  if (!cache_directory.empty()) {
+    cache.reset(new TUCache(cache_directory));
+  }
+
+  size_t failed;
+  // the binary format needs the whole graph, so collect the records first
+  ostringstream records;
+  {
+    ExtractionPool pool(compile_commands, jobs, cache.get());
+    failed = pool.write_ordered(binary ? records : cout);
+  }
+  if (binary && failed == compile_commands.size()) {
+    istringstream text(records.str());
+    dump_binary_call_graph(parseCallGraph(text), cout);
+  }
+  cout.flush();
+
+  if (failed != compile_commands.size()) {
+    cerr << "CXTranslationUnit:";
+    for (auto &&arg : compile_commands[failed]) {
+      cerr << " " << arg;
+    }
+    cerr << endl;
+    fatal("parse failed");
   }
-  clang_disposeIndex(index);
 }
@@ -2,40 +2,95 @@
 
 #include "myassert.h"
 #include "graph.h"
+#include "mapped_file.h"
 #include "node.h"
 
 #include <algorithm>
 #include <cassert>
-#include <fstream>
-#include <regex>
+#include <cstring>
+#include <cstdint>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
 
 using namespace std;
 
 void dump_call_graph(const Graph &graph, ostream &o) {
   for (auto &&node : graph.nodes) {
-    o << dynamic_cast<const Node &>(*node) << endl;
+    o << *node << endl;
     for (auto &&edge : node->neighborhood.outgoing) {
-      o << "  calls " << dynamic_cast<Node *>(edge->head)->fullname
-        << dynamic_cast<const Edge *>(edge)->range << endl;
+      o << "  calls " << as_node(edge->head)->fullname << as_edge(edge)->range
+        << endl;
     }
     for (auto &&edge : node->neighborhood.incoming) {
-      o << "  is called from " << dynamic_cast<Node *>(edge->tail)->fullname
-        << dynamic_cast<const Edge *>(edge)->range << endl;
+      o << "  is called from " << as_node(edge->tail)->fullname
+        << as_edge(edge)->range << endl;
     }
   }
 }
 
+const uint64_t EdgeIndex::empty;
+
+// the finalizer of splitmix64, the keys themselves are far from random
+static size_t mix(uint64_t key) {
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+  return key ^ (key >> 31);
+}
+
+size_t EdgeIndex::find_slot(uint64_t key) const {
+  size_t mask = slots_.size() - 1;
+  size_t i = mix(key) & mask;
+  while (slots_[i].first != key && slots_[i].first != empty) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+void EdgeIndex::grow(size_t capacity) {
+  vector<pair<uint64_t, EdgeBase *>> slots(capacity, {empty, nullptr});
+  slots.swap(slots_);
+  for (auto &&slot : slots) {
+    if (slot.first != empty) {
+      slots_[find_slot(slot.first)] = slot;
+    }
+  }
+}
+
+EdgeBase *EdgeIndex::find(uint64_t key) const {
+  return slots_.empty() ? nullptr : slots_[find_slot(key)].second;
+}
+
+void EdgeIndex::insert(uint64_t key, EdgeBase *edge) {
+  // keep the load factor at or below one half
+  if (2 * (size_ + 1) > slots_.size()) {
+    grow(slots_.empty() ? 64 : 2 * slots_.size());
+  }
+  slots_[find_slot(key)] = {key, edge};
+  ++size_;
+}
+
+void EdgeIndex::reserve(size_t count) {
+  size_t capacity = slots_.empty() ? 64 : slots_.size();
+  while (2 * count > capacity) {
+    capacity *= 2;
+  }
+  if (capacity != slots_.size()) {
+    grow(capacity);
+  }
+}
+
 /*
  * If the name is already in the graph, return the pointer, otherwise add it
  */
 pair<Node *, bool> Graph::try_createNode(const Fullname &fullname) {
-  auto &&kv = name_to_node.find(fullname);
-  if (kv != name_to_node.end()) {
-    return {dynamic_cast<Node *>(kv->second), false};
+  auto id = names.intern(fullname);
+  if (!id.second) {
+    return {nodes[id.first], false};
   }
-  Node *node = new Node{fullname};
+  Node *node = arena.create<Node>(id.first, names.name(id.first));
   nodes.push_back(node);
-  name_to_node[node->fullname] = node;
+  name_to_node.push_back(node);
   return {node, true};
 }
 
@@ -44,83 +99,340 @@ pair<Node *, bool> Graph::try_createNode(const Fullname &fullname) {
  */
 pair<Edge *, bool> Graph::try_createEdge(Node *tail, Node *head) {
   assert(tail && head && __func__);
-  auto kv = name_to_edge.find(tail->fullname + "," + head->fullname);
-  if (kv != name_to_edge.end()) {
-    return {dynamic_cast<Edge *>(kv->second), false};
+  uint64_t key = edge_key(tail->id, head->id);
+  if (EdgeBase *found = name_to_edge.find(key)) {
+    return {as_edge(found), false};
   }
-  Edge *edge = new Edge(tail, head);
+  Edge *edge = arena.create<Edge>(tail, head);
   edges.push_back(edge);
-  tail->neighborhood.outgoing.push_back(edge);
-  head->neighborhood.incoming.push_back(edge);
+  name_to_edge.insert(key, edge);
   return {edge, true};
 }
 
-SourceRange get_sourceRangeFromMatch(const smatch &m) {
-  SourceLocation begin = {m[2], stoull(m[3]), stoull(m[4]), stoull(m[5])};
-  SourceLocation end = {m[6], stoull(m[7]), stoull(m[8]), stoull(m[9])};
-  return {begin, end};
+/*
+ * A counting sort of the edges by tail and by head.  Node ids are their
+ * indices in nodes, so they serve as the row numbers.
+ */
+void Graph::build_adjacency() {
+  vector<size_t> out_offsets(nodes.size() + 1, 0);
+  vector<size_t> in_offsets(nodes.size() + 1, 0);
+  for (auto edge : edges) {
+    ++out_offsets[edge->tail->id + 1];
+    ++in_offsets[edge->head->id + 1];
+  }
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    out_offsets[i + 1] += out_offsets[i];
+    in_offsets[i + 1] += in_offsets[i];
+  }
+
+  outgoing.assign(edges.size(), nullptr);
+  incoming.assign(edges.size(), nullptr);
+  {
+    vector<size_t> out_next(out_offsets.begin(), out_offsets.end() - 1);
+    vector<size_t> in_next(in_offsets.begin(), in_offsets.end() - 1);
+    for (auto edge : edges) {
+      outgoing[out_next[edge->tail->id]++] = edge;
+      incoming[in_next[edge->head->id]++] = edge;
+    }
+  }
+
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    nodes[i]->neighborhood.outgoing = {outgoing.data() + out_offsets[i],
+                                       outgoing.data() + out_offsets[i + 1]};
+    nodes[i]->neighborhood.incoming = {incoming.data() + in_offsets[i],
+                                       incoming.data() + in_offsets[i + 1]};
+  }
 }
 
-// file_ex allows for escaped spaces
-const string &file_ex = "\\s*(\\S*|\\\\\\s)*\\s*";
-const string &line_ex = "(\\d*)\\s*";
-const string &column_ex = "(\\d*)\\s*";
-const string &offset_ex = "(\\d*)\\s*";
-const string &location_ex = file_ex + line_ex + column_ex + offset_ex;
-const string &calls_ex = "\\s*calls\\s*";
+/*
+ * Single pass scanner for one line of the text format:
+ *
+ *   [indent]$caller$ file line column offset  file line column offset
+ *   [indent]calls $callee$ file line column offset  file line column offset
+ *
+ * The name runs to the last '$' on the line, like the greedy regex this
+ * replaces.  A file name may contain escaped spaces ("\ "), and is left out
+ * entirely when clang had no file for the location, so a location is either
+ * 4 or 3 fields.
+ */
+class CallGraphLineScanner {
+  const char *p_;
+  const char *end_;
+  SymbolTable &files_;
+
+  static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+  }
+
+  void skip_spaces() {
+    while (p_ != end_ && is_space(*p_)) {
+      ++p_;
+    }
+  }
+
+  static bool parse_number(const pair<const char *, const char *> &field,
+                           size_t &n) {
+    n = 0;
+    for (const char *p = field.first; p != field.second; ++p) {
+      if (*p < '0' || *p > '9') {
+        return false;
+      }
+      n = n * 10 + (*p - '0');
+    }
+    return true;
+  }
+
+  bool parse_location(const pair<const char *, const char *> *fields,
+                      bool has_filename, SourceLocation &location) {
+    if (has_filename) {
+      location.filename = &files_.name(
+          files_.intern(fields->first, fields->second - fields->first).first);
+      ++fields;
+    } else {
+      location.filename = &no_filename;
+    }
+    return parse_number(fields[0], location.line) &&
+           parse_number(fields[1], location.column) &&
+           parse_number(fields[2], location.offset);
+  }
+
+public:
+  bool is_call;
+  pair<const char *, const char *> name;
+
+  static bool starts_with_calls(const char *p, const char *end) {
+    return end - p > 5 && !memcmp(p, "calls", 5) &&
+           (is_space(p[5]) || p[5] == '$');
+  }
+
+  static bool is_call_line(const char *line, const char *eol) {
+    while (line != eol && is_space(*line)) {
+      ++line;
+    }
+    return starts_with_calls(line, eol);
+  }
 
-const string &fn_name_ex = "\\s*\\$(.*)\\$";
+  // file names are interned in files
+  CallGraphLineScanner(const char *begin, const char *end, SymbolTable &files)
+      : p_(begin), end_(end), files_(files), is_call(false) {}
 
-const regex caller_ex(fn_name_ex + location_ex + location_ex);
-const regex callee_ex(calls_ex + fn_name_ex + location_ex + location_ex);
+  bool scan(SourceRange &range) {
+    skip_spaces();
+    if (starts_with_calls(p_, end_)) {
+      is_call = true;
+      p_ += 5;
+      skip_spaces();
+    }
+    if (p_ == end_ || *p_ != '$') {
+      return false;
+    }
+    const char *last_dollar = end_ - 1;
+    while (last_dollar != p_ && *last_dollar != '$') {
+      --last_dollar;
+    }
+    if (last_dollar == p_) {
+      return false;
+    }
+    name = {p_ + 1, last_dollar};
+    p_ = last_dollar + 1;
+
+    pair<const char *, const char *> fields[8];
+    size_t count = 0;
+    for (skip_spaces(); p_ != end_; skip_spaces()) {
+      if (count == 8) {
+        return false;
+      }
+      const char *begin = p_;
+      while (p_ != end_ && !is_space(*p_)) {
+        p_ += (*p_ == '\\' && p_ + 1 != end_) ? 2 : 1;
+      }
+      fields[count++] = {begin, p_};
+    }
+    // with 7 fields the begin location kept its file, as the regex would have
+    if (count < 6) {
+      return false;
+    }
+    bool begin_has_filename = count > 6;
+    return parse_location(fields, begin_has_filename, range.begin) &&
+           parse_location(fields + (begin_has_filename ? 4 : 3), count == 8,
+                          range.end);
+  }
+};
 
 Graph parseCallGraphFromFile(const std::string &filename) {
+  MappedFile file(filename);
+  if (!file) {
+    // empty files can't be mapped, and hold an empty graph anyway
+    return Graph();
+  }
+  return parseCallGraph(file.data(), file.end());
+}
+
+Graph parseCallGraph(std::istream &file) {
+  string text{istreambuf_iterator<char>(file), istreambuf_iterator<char>()};
+  return parseCallGraph(text.data(), text.data() + text.size());
+}
+
+/*
+ * The records of one chunk of a text call graph, with the node names interned
+ * locally in order of first appearance.  Chunks are parsed independently and
+ * then merged into the Graph in file order, which creates the nodes and edges
+ * in the same order as parsing the whole file at once.
+ */
+struct ParsedChunk {
+  struct ParsedEdge {
+    NameId tail;
+    NameId head;
+    SourceRange range; // of the first call site in the chunk
+    size_t calls;
+  };
+
+  SymbolTable names;
+  SymbolTable files; // the ranges point into this
+  vector<pair<NameId, SourceRange>> node_ranges;
+  vector<ParsedEdge> edges;
+  size_t lines = 0;
+  string error_line; // set if a line failed to parse, the chunk stops there
+
+  void parse(const char *begin, const char *end) {
+    auto local = [this](const char *first, const char *last) {
+      return names.intern(first, last - first).first;
+    };
+    // repeated calls are counted here, to keep the chunk small
+    unordered_map<uint64_t, size_t> edge_index;
+    SourceRange range;
+    NameId caller = 0;
+    bool have_caller = false;
+
+    for (const char *line = begin, *eol; line != end;
+         line = eol + (eol != end)) {
+      ++lines;
+      eol = static_cast<const char *>(memchr(line, '\n', end - line));
+      if (!eol) {
+        eol = end;
+      }
+      if (line == eol) {
+        // skip empty line
+        continue;
+      }
+      CallGraphLineScanner scanner(line, eol, files);
+      if (!scanner.scan(range)) {
+        error_line.assign(line, eol);
+        return;
+      }
+      if (scanner.is_call) {
+        // found edge, only the first chunk can have calls before a caller
+        if (!have_caller) {
+          caller = local(line, line);
+          have_caller = true;
+        }
+        NameId callee = local(scanner.name.first, scanner.name.second);
+        auto kv = edge_index.emplace(edge_key(caller, callee), edges.size());
+        if (kv.second) {
+          edges.push_back({caller, callee, range, 1});
+        } else {
+          ++edges[kv.first->second].calls;
+        }
+      } else {
+        // found node
+        caller = local(scanner.name.first, scanner.name.second);
+        have_caller = true;
+        node_ranges.emplace_back(caller, range);
+      }
+    }
+  }
+};
+
+/*
+ * Cuts [begin, end) into at most count pieces of similar size.  Every cut is
+ * at the start of a caller line, so no caller is separated from its calls.
+ */
+vector<const char *> split_at_callers(const char *begin, const char *end,
+                                      size_t count) {
+  vector<const char *> cuts{begin};
+  for (size_t i = 1; i < count; ++i) {
+    const char *p = max(cuts.back(), begin + (end - begin) / count * i);
+    while (p != end) {
+      // move to the start of the next line
+      p = static_cast<const char *>(memchr(p, '\n', end - p));
+      if (!p) {
+        p = end;
+        break;
+      }
+      const char *line = ++p;
+      const char *eol =
+          static_cast<const char *>(memchr(line, '\n', end - line));
+      if (!CallGraphLineScanner::is_call_line(line, eol ? eol : end)) {
+        break;
+      }
+    }
+    if (p != cuts.back() && p != end) {
+      cuts.push_back(p);
+    }
+  }
+  cuts.push_back(end);
+  return cuts;
+}
+
+// below this, a file is parsed on the calling thread only
+const size_t min_parallel_chunk_size = 1 << 20;
+
+Graph parseCallGraph(const char *begin, const char *end) {
+  size_t threads = max(1u, thread::hardware_concurrency());
+  threads = min<size_t>(threads, (end - begin) / min_parallel_chunk_size + 1);
+  vector<const char *> cuts = split_at_callers(begin, end, threads);
+
+  vector<ParsedChunk> chunks(cuts.size() - 1);
+  vector<thread> workers;
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    workers.emplace_back(&ParsedChunk::parse, &chunks[i], cuts[i],
+                         cuts[i + 1]);
+  }
+  chunks[0].parse(cuts[0], cuts[1]);
+  for (auto &&worker : workers) {
+    worker.join();
+  }
+
   Graph graph;
-  smatch m;
-  string line;
   size_t line_no = 0;
-  Fullname caller;
-  Fullname callee;
-  SourceRange range;
-  ifstream file(filename);
-
-  while (file.good()) {
-    ++line_no;
-    getline(file, line);
-    if (line.empty()) {
-      // skip empty line
-      continue;
-    }
-    if (regex_match(line, m, callee_ex)) {
-      // found edge
-      callee = m[1];
-      range = get_sourceRangeFromMatch(m);
-      auto caller_pair = graph.try_createNode(caller);
-      auto callee_pair = graph.try_createNode(callee);
+  vector<Node *> nodes;
+  for (auto &&chunk : chunks) {
+    nodes.clear();
+    for (NameId id = 0; id < chunk.names.size(); ++id) {
+      nodes.push_back(graph.try_createNode(chunk.names.name(id)).first);
+    }
+    for (auto &&kv : chunk.node_ranges) {
+      nodes[kv.first]->range = graph.intern_files(kv.second);
+    }
+    for (auto &&parsed : chunk.edges) {
       auto edge_pair =
-          graph.try_createEdge(caller_pair.first, callee_pair.first);
-      edge_pair.first->range = range;
-    } else if (regex_match(line, m, caller_ex)) {
-      // found node
-      caller = m[1];
-      range = get_sourceRangeFromMatch(m);
-      auto node_p = graph.try_createNode(caller);
-      node_p.first->range = range;
-    } else {
-      DIAGNOSTIC << "error parsing line[" << line_no << "]: " << line << endl;
-      return graph;
+          graph.try_createEdge(nodes[parsed.tail], nodes[parsed.head]);
+      if (edge_pair.second) {
+        edge_pair.first->range = graph.intern_files(parsed.range);
+        edge_pair.first->calls = parsed.calls;
+      } else {
+        edge_pair.first->calls += parsed.calls;
+      }
+    }
+    line_no += chunk.lines;
+    if (!chunk.error_line.empty()) {
+      DIAGNOSTIC << "error parsing line[" << line_no
+                 << "]: " << chunk.error_line << endl;
+      break;
     }
   }
+  graph.build_adjacency();
   return graph;
 }
 
-Graph::~Graph() {
-  for (auto &&node : nodes) {
-    delete node;
-  }
-  for (auto &&edge : edges) {
-    delete edge;
+SourceRange Graph::intern_files(const SourceRange &range) {
+  SourceRange result = range;
+  for (SourceLocation *location : {&result.begin, &result.end}) {
+    if (location->filename != &no_filename) {
+      location->filename = &files.name(files.intern(*location->filename).first);
+    }
   }
+  return result;
 }
 
 vector<NodeBase *> Graph::get_roots() const {
@@ -128,7 +440,7 @@ vector<NodeBase *> Graph::get_roots() const {
   copy_if(nodes.begin(), nodes.end(), back_inserter(result),
           [](const NodeBase *node) {
             if (node->in_degree() == 0) {
-              DIAGNOSTIC << "found root: " << dynamic_cast<const Node &>(*node) << " "
+              DIAGNOSTIC << "found root: " << *as_node(node) << " "
                    << (unsigned long long)node << endl;
             }
             return node->in_degree() == 0;
@@ -1,31 +1,88 @@
 // graph.h
 #pragma once
 
+#include "arena.h"
 #include "node.h"
+#include "symbol_table.h"
 
+#include <cstdint>
 #include <iostream>
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
+/*
+ * Open addressing hash from edge_key (the NameIds of tail and head) to the
+ * edge.  Keys and values sit side by side so a probe touches one cache line.
+ */
+class EdgeIndex {
+  static const uint64_t empty = uint64_t(-1);
+  std::vector<std::pair<uint64_t, EdgeBase *>> slots_;
+  size_t size_ = 0;
+
+  size_t find_slot(uint64_t key) const;
+  void grow(size_t capacity);
+
+public:
+  EdgeBase *find(uint64_t key) const;
+  // the key must not be in the index yet
+  void insert(uint64_t key, EdgeBase *edge);
+  void reserve(size_t count);
+  size_t size() const { return size_; }
+};
+
 struct Graph {
+  // the nodes and edges live here, and are released all at once
+  Arena arena;
+  SymbolTable names; // the names of the nodes, interned
+  SymbolTable files; // the file names of the source ranges, interned
   std::vector<Node *> nodes;
   std::vector<Edge *> edges;
   /*
-   * The following maps map to the base class pointers so that other components
-   * can use these tables without knowing about the nodes.
+   * Compressed sparse rows: the edges grouped by tail and by head, each group
+   * in order of creation.  The neighborhood of every node is its slice of
+   * these.
+   */
+  std::vector<EdgeBase *> outgoing;
+  std::vector<EdgeBase *> incoming;
+  /*
+   * The following tables map to the base class pointers so that other
+   * components can use these tables without knowing about the nodes.
+   * name_to_node is indexed by NameId, name_to_edge is keyed on the NameIds of
+   * the tail and head (see edge_key).
    */
-  std::unordered_map<Fullname, NodeBase *> name_to_node;
-  std::unordered_map<Fullname, EdgeBase *> name_to_edge;
+  std::vector<NodeBase *> name_to_node;
+  EdgeIndex name_to_edge;
 
   std::pair<Node *, bool> try_createNode(const Fullname &);
+  /*
+   * There is at most one edge from tail to head, repeated calls return it.
+   * Edge::calls is left for the caller to count.
+   */
   std::pair<Edge *, bool> try_createEdge(Node *tail, Node *head);
+  /*
+   * Fills in outgoing, incoming and the node neighborhoods.  Call it once the
+   * last edge has been created, until then the neighborhoods are empty.
+   */
+  void build_adjacency();
+  // a copy of range with its file names pointing into files
+  SourceRange intern_files(const SourceRange &range);
 
   //gets nodes with in_degree == 0
   std::vector<NodeBase *> get_roots() const; 
 
-  ~Graph();
+  // the graph owns its nodes and edges, so it can be moved but not copied
+  Graph() = default;
+  Graph(const Graph &) = delete;
+  Graph(Graph &&) = default;
+  Graph &operator=(const Graph &) = delete;
 };
 
+inline uint64_t edge_key(NameId tail, NameId head) {
+  return uint64_t(tail) << 32 | head;
+}
+
 void dump_call_graph(const Graph &graph, std::ostream &o = std::cout);
+Graph parseCallGraph(std::istream &i);
+Graph parseCallGraph(const char *begin, const char *end);
 Graph parseCallGraphFromFile(const std::string &filename);
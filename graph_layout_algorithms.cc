@@ -4,7 +4,6 @@
 #include "myassert.h"
 
 #include <algorithm>
-#include <numeric>
 #include <stack>
 #include <unordered_map>
 
@@ -12,46 +11,49 @@
 
 using namespace std;
 
-struct Grid {
-  int row;
-  int column;
-  Grid(int row, int column) : row(row), column(column) {}
-  Grid() : row(0), column(0) {}
-};
-
-using GridMap = unordered_map<NodeBase *, Grid>;
+const size_t GridLayout::npos;
 
 /*
- * Root is assumed to be "main()"
- *
- * (Deprecated, View now has explicit roots)
+ * A node on the DFS stack, with the first of its outgoing edges that has not
+ * been looked at yet.  Edges before it lead to visited nodes or out of the
+ * view, and stay that way for the rest of the search.
  */
-void init_stack(stack<NodeBase *> &node_stack, const View &view,
-                GridMap &gridMap) {
-  auto kv =
-      find_if(view.name_to_node->begin(), view.name_to_node->end(),
-              [](const unordered_map<Fullname, NodeBase *>::value_type &kv) {
-                return kv.first == "main()" || kv.first == "main(int, char **)";
-              });
-  if (kv == view.name_to_node->end()) {
-    cout << "couldn't find node main()" << endl;
-    return;
-  }
-  node_stack.push(kv->second);
-  gridMap[kv->second] = Grid(0, 0);
+struct DfsFrame {
+  NodeBase *node;
+  size_t step;
+  EdgeBase *const *next;
+  DfsFrame(NodeBase *node, size_t step)
+      : node(node), step(step), next(node->neighborhood.outgoing.begin()) {}
+};
+
+struct DfsState {
+  stack<DfsFrame> node_stack;
+  int max_row = 0;
+  int max_column = 0;
+  size_t next_root = 0; // the roots before it have been visited
+};
+
+void place(View &view, DfsState &state, NodeBase *node, int row, int column,
+           size_t parent) {
+  GridLayout &grid = view.grid;
+  bool visible = view.logicalSubView.count(node);
+  grid.step_of[node] = grid.steps.size();
+  grid.steps.push_back({node, row, column, parent, state.next_root,
+                        state.max_column, visible,
+                        visible ? view.viewData.at(node).box->extent
+                                : Extent()});
+  state.node_stack.emplace(node, grid.steps.size() - 1);
 }
 
 /*
  * When the stack is empty, look for a new root
  */
-bool refresh_stack(stack<NodeBase *> &node_stack, const View &view,
-                   GridMap &gridMap, int &max_row) {
-  for (auto &&node : view.roots) {
+bool refresh_stack(View &view, DfsState &state) {
+  for (; state.next_root < view.roots.size(); ++state.next_root) {
+    NodeBase *node = view.roots[state.next_root];
     // not visited
-    if (!gridMap.count(node)) {
-      node_stack.push(node);
-      gridMap[node] = Grid(max_row++, 0);
-      DIAGNOSTIC << "pushing root: " << view.viewData.at(node).text << endl;
+    if (!view.grid.step_of.count(node)) {
+      place(view, state, node, state.max_row++, 0, GridLayout::npos);
       return true;
     }
   }
@@ -59,106 +61,232 @@ bool refresh_stack(stack<NodeBase *> &node_stack, const View &view,
 }
 
 /*
- * maximum row value and maximum column value are returned (it is useful for the
- * rest of the layout algorithm)
+ * Runs the DFS to completion, appending a step for each node placed
  */
-pair<int, int> set_grid_dfs(const View &view, GridMap &gridMap) {
-  // the gridMap keeps track of which nodes have been visited
-  stack<NodeBase *> node_stack;
-  int max_row = 0;
-  int max_column = 0;
-
-  // init_stack(node_stack, view, gridMap);
-
-  while (!node_stack.empty() ||
-         refresh_stack(node_stack, view, gridMap, max_row)) {
-    const auto &outgoing = node_stack.top()->neighborhood.outgoing;
-    int next_column = gridMap[node_stack.top()].column + 1;
-    auto next = find_if(outgoing.begin(), outgoing.end(),
-                        [&view, &gridMap](EdgeBase *edge) {
-                          // if a node is not in the gridMap, it hasn't been
-                          // visited
+void set_grid_dfs(View &view, DfsState &state) {
+  // the step_of map keeps track of which nodes have been visited
+  const GridLayout &grid = view.grid;
+  while (!state.node_stack.empty() || refresh_stack(view, state)) {
+    DfsFrame &top = state.node_stack.top();
+    const auto &outgoing = top.node->neighborhood.outgoing;
+    int next_column = grid.steps[top.step].column + 1;
+    auto next = find_if(top.next, outgoing.end(),
+                        [&view, &grid](EdgeBase *edge) {
+                          // if a node has no step, it hasn't been visited
                           return view.logicalSubView.count(edge->head) &&
-                                 !gridMap.count(edge->head);
+                                 !grid.step_of.count(edge->head);
                         });
+    top.next = next;
     if (next == outgoing.end()) {
-      node_stack.pop();
+      state.node_stack.pop();
     } else {
       if (next != outgoing.begin()) {
-        ++max_row;
+        ++state.max_row;
       }
-      node_stack.push((*next)->head);
-      gridMap[(*next)->head] = Grid(max_row, next_column);
-      max_column = max<int>(next_column, max_column);
+      state.max_column = max<int>(next_column, state.max_column);
+      place(view, state, (*next)->head, state.max_row, next_column, top.step);
     }
   }
-  return {max_row, max_column};
 }
 
 /*
- * go through setting row/column width
+ * The first step whose outcome can differ now that the nodes in grid.changed
+ * were shown or hidden: where one of them was placed, or right after one of
+ * their parents was placed (the parent may pick it up from then on).
  */
-void get_row_column_dimensions(const View &view, const GridMap &gridMap,
-                               vector<double> &row_height,
-                               vector<double> &column_width) {
-  for (auto &&node : view.logicalSubView) {
-    // set max col/row...
-    const double &node_height = view.viewData.at(node).box->extent.y;
-    const double &node_width = view.viewData.at(node).box->extent.x;
-    const int &row = gridMap.at(node).row;
-    const int &column = gridMap.at(node).column;
-    row_height[row] = max<double>(row_height[row], node_height);
-    column_width[column] = max<double>(column_width[column], node_width);
+size_t first_affected_step(const GridLayout &grid) {
+  if (!grid.valid) {
+    return 0;
+  }
+  auto step_of = [&grid](NodeBase *node) {
+    auto kv = grid.step_of.find(node);
+    return kv == grid.step_of.end() ? GridLayout::npos : kv->second;
+  };
+  size_t first = grid.steps.size();
+  for (auto node : grid.changed) {
+    first = min(first, step_of(node));
+    for (auto edge : node->neighborhood.incoming) {
+      size_t step = step_of(edge->tail);
+      if (step != GridLayout::npos) {
+        first = min(first, step + 1);
+      }
+    }
   }
+  return first;
 }
 
 /*
- * calculate the positions based of results of rest of layout algorithm
+ * Forgets the steps from first on, and returns the DFS state as it was right
+ * after the step before it.  The stack is rebuilt from the parent links; every
+ * frame can restart at its first edge, because first is no later than one
+ * step after any parent of a changed node, so the edges a frame had already
+ * passed still lead to visited or hidden nodes.
  */
-void set_initial_positions(View &view, const GridMap &gridMap,
-                           const vector<double> &row_height,
-                           const vector<double> &column_width) {
-  for (auto &node : view.logicalSubView) {
-    const int &row = gridMap.at(node).row;
-    const int &column = gridMap.at(node).column;
-    double row_pos = 0;
-    double column_pos = 0;
-    if (row != 0) {
-      row_pos =
-          accumulate(row_height.begin(), next(row_height.begin(), row), 0.0);
-      row_pos += row * view.row_spacing;
+DfsState rewind(GridLayout &grid, size_t first) {
+  DfsState state;
+  for (size_t step = grid.steps.size(); step-- > first;) {
+    const GridPlacement &placement = grid.steps[step];
+    grid.step_of.erase(placement.node);
+    if (placement.visible) {
+      grid.column_steps[placement.column].pop_back();
+      auto &widening = grid.column_widening[placement.column];
+      if (!widening.empty() && widening.back().first == step) {
+        widening.pop_back();
+      }
     }
-    if (column != 0) {
-      column_pos = accumulate(column_width.begin(),
-                              next(column_width.begin(), column), 0.0);
-      column_pos += column * view.column_spacing;
-      DIAGNOSTIC << view.viewData.at(node).text << ", row: " << row
-                 << ", row_pos: " << row_pos << ", column: " << column
-                 << ", column_pos: " << column_pos << endl;
+  }
+  grid.steps.resize(first);
+  if (first == 0) {
+    return state;
+  }
+  const GridPlacement &last = grid.steps[first - 1];
+  // a root is placed on max_row, which then moves past it
+  state.max_row = last.row + (last.parent == GridLayout::npos);
+  state.max_column = last.max_column;
+  state.next_root = last.root_index;
+  vector<size_t> path;
+  for (size_t step = first - 1; step != GridLayout::npos;
+       step = grid.steps[step].parent) {
+    path.push_back(step);
+  }
+  for (auto step = path.rbegin(); step != path.rend(); ++step) {
+    state.node_stack.emplace(grid.steps[*step].node, *step);
+  }
+  return state;
+}
+
+/*
+ * Rows only grow along the steps, so the rows before the one the first new
+ * step continues are untouched.  Their heights and sums are kept; the rest are
+ * recomputed from the steps in them.  The new steps are added to their
+ * columns, whose widths are then known without looking at the older steps.
+ * Returns the first column whose offset moved.
+ */
+int set_dimensions(View &view, size_t first, int max_row, int max_column) {
+  GridLayout &grid = view.grid;
+  int first_row = first ? grid.steps[first - 1].row : 0;
+  size_t first_in_row = first;
+  while (first_in_row && grid.steps[first_in_row - 1].row == first_row) {
+    --first_in_row;
+  }
+  grid.row_height.resize(first_row);
+  grid.row_height.resize(max_row + 1, 0);
+  for (size_t step = first_in_row; step < grid.steps.size(); ++step) {
+    const GridPlacement &placement = grid.steps[step];
+    if (placement.visible) {
+      double &height = grid.row_height[placement.row];
+      height = max<double>(height, placement.extent.y);
     }
-    /*
-     * Here, notice that column_pos is the first coordinate and row_pos is the
-     * second, this is because with position we go from the "row, column"
-     * semantics of the grid to the "x,y" semantics of cartesian coordinates
-     */
-    view.viewData.at(node).box->position.x = column_pos;
-    view.viewData.at(node).box->position.y = row_pos;
+  }
+  grid.row_sum.resize(first_row + 1, 0);
+  for (int row = first_row; row < max_row; ++row) {
+    grid.row_sum.push_back(grid.row_sum[row] + grid.row_height[row]);
+  }
+
+  // the columns past max_column lost all their steps in rewind
+  grid.column_steps.resize(max_column + 1);
+  grid.column_widening.resize(max_column + 1);
+  for (size_t step = first; step < grid.steps.size(); ++step) {
+    const GridPlacement &placement = grid.steps[step];
+    if (placement.visible) {
+      grid.column_steps[placement.column].push_back(step);
+      auto &widening = grid.column_widening[placement.column];
+      if (widening.empty() || widening.back().second < placement.extent.x) {
+        widening.emplace_back(step, placement.extent.x);
+      }
+    }
+  }
+  vector<double> column_offset(max_column + 1);
+  double sum = 0;
+  for (size_t i = 0; i < column_offset.size(); ++i) {
+    column_offset[i] = i ? sum + i * view.column_spacing : 0;
+    const auto &widening = grid.column_widening[i];
+    sum += widening.empty() ? 0 : widening.back().second;
+  }
+  size_t common = min(column_offset.size(), grid.column_offset.size());
+  auto moved = mismatch(column_offset.begin(), column_offset.begin() + common,
+                        grid.column_offset.begin());
+  grid.column_offset.swap(column_offset);
+  return moved.first - grid.column_offset.begin();
+}
+
+/*
+ * Moves the box of a visible step to its grid cell, and tells the spatial
+ * index if it wasn't there already
+ */
+void set_position(View &view, const GridPlacement &placement) {
+  const GridLayout &grid = view.grid;
+  double row_pos =
+      placement.row
+          ? grid.row_sum[placement.row] + placement.row * view.row_spacing
+          : 0;
+  double column_pos = grid.column_offset[placement.column];
+  /*
+   * Here, notice that column_pos is the first coordinate and row_pos is the
+   * second, this is because with position we go from the "row, column"
+   * semantics of the grid to the "x,y" semantics of cartesian coordinates
+   */
+  Point &position = view.viewData.at(placement.node).box->position;
+  if (position.x != column_pos || position.y != row_pos) {
+    position.x = column_pos;
+    position.y = row_pos;
+    view.spatial_index.moved(placement.node);
+    view.layout_moves.nodes.push_back(placement.node);
   }
 }
 
 /*
- * Create a view of the entire graph with nodes assigned grid locations DFS wise
+ * Lay out the whole view with nodes assigned grid locations DFS wise.  If the
+ * view was laid out before and only the nodes in view.grid.changed were shown
+ * or hidden since, the DFS resumes from the first step they affect, and only
+ * the nodes from there on and the ones in columns that moved sideways are
+ * visited and put in their grid cells.  The grid is the same as laying out
+ * from scratch, but the other nodes keep their positions, also where the
+ * user dragged them to.
  */
 void dfs_grid_layout(View &view) {
-  vector<double> row_height;
-  vector<double> column_width;
-  unordered_map<NodeBase *, Grid> gridMap;
-  // calculate node grid positions, get the maximum row and column values
-  pair<int, int> max_row_column = set_grid_dfs(view, gridMap);
-  row_height.resize(max_row_column.first + 1);
-  column_width.resize(max_row_column.second + 1);
-  get_row_column_dimensions(view, gridMap, row_height, column_width);
-  set_initial_positions(view, gridMap, row_height, column_width);
+  GridLayout &grid = view.grid;
+  if (!grid.valid) {
+    // every node moves, the index is rebuilt rather than updated
+    view.spatial_index.invalidate();
+    view.layout_moves.all = true;
+  }
+  size_t first = first_affected_step(grid);
+  DfsState state = rewind(grid, first);
+  set_grid_dfs(view, state);
+  int first_moved_column =
+      set_dimensions(view, first, state.max_row, state.max_column);
+  for (size_t step = first; step < grid.steps.size(); ++step) {
+    if (grid.steps[step].visible) {
+      set_position(view, grid.steps[step]);
+    }
+  }
+  for (size_t column = first_moved_column; column < grid.column_steps.size();
+       ++column) {
+    for (auto step : grid.column_steps[column]) {
+      if (step >= first) {
+        break;
+      }
+      set_position(view, grid.steps[step]);
+    }
+  }
+  grid.changed.clear();
+  grid.valid = true;
+}
+
+LayoutAlgorithm find_layout_algorithm(const string &name) {
+  static const struct {
+    const char *name;
+    LayoutAlgorithm algorithm;
+  } algorithms[] = {{"dfs", dfs_grid_layout},
+                    {"layered", layered_layout},
+                    {"force", force_directed_layout}};
+  for (auto &&algorithm : algorithms) {
+    if (name == algorithm.name) {
+      return algorithm.algorithm;
+    }
+  }
+  return nullptr;
 }
 
 /*
@@ -172,9 +300,13 @@ void expand_node(View &view, NodeBase *node) {
              << endl;
   auto box = *view.viewData.at(node).box;
   for (auto edge : node->neighborhood.outgoing) {
-    view.logicalSubView.insert(edge->head);
-    DIAGNOSTIC << "accessing node: " << edge->head << endl;
-    view.viewData.at(edge->head).box->position = box.position;
+    // children that were already visible stay where they are
+    if (view.logicalSubView.insert(edge->head).second) {
+      view.grid.changed.push_back(edge->head);
+      DIAGNOSTIC << "accessing node: " << edge->head << endl;
+      view.viewData.at(edge->head).box->position = box.position;
+      view.spatial_index.moved(edge->head);
+    }
   }
   view.viewData.at(node).expanded = true;
 }
@@ -202,18 +334,33 @@ vector<NodeBase *> get_nodes_to_collapse(const View &view, NodeBase *node) {
  * Do the opposite of above.  Note that if a child has another parent that is
  * expanded, then it will remain visible.
  */
-void collapse_node(View &view, NodeBase *node) {
+vector<NodeBase *> collapse_node(View &view, NodeBase *node) {
   DIAGNOSTIC << "collapsing node: " << &node << endl;
-  auto nodes_to_collapse = get_nodes_to_collapse(view, node);
-  //calculate the layout like the collapsed nodes aren't there...
-  for (auto node : nodes_to_collapse) {
-    view.logicalSubView.erase(node);
-  }
-  dfs_grid_layout(view);
-  auto box = *view.viewData.at(node).box;
-  for (auto node : nodes_to_collapse) {
-    view.viewData.at(node).box->position = box.position;
-    view.logicalSubView.insert(node);
+  vector<NodeBase *> collapsed;
+  for (auto child : get_nodes_to_collapse(view, node)) {
+    if (view.logicalSubView.erase(child)) {
+      view.grid.changed.push_back(child);
+      view.spatial_index.moved(child);
+      view.physicalSubView.nodes.erase(child);
+      collapsed.push_back(child);
+    }
   }
   view.viewData.at(node).expanded = false;
+  return collapsed;
+}
+
+void gather_collapsed_nodes(View &view, NodeBase *node,
+                            const vector<NodeBase *> &collapsed,
+                            vector<NodePosition> &positions) {
+  Point end = view.viewData.at(node).box->position;
+  for (auto &&position : positions) {
+    if (position.first == node) {
+      end = position.second;
+    }
+  }
+  for (auto child : collapsed) {
+    view.logicalSubView.insert(child);
+    view.spatial_index.moved(child);
+    positions.emplace_back(child, end);
+  }
 }
@@ -1,10 +1,16 @@
 // graph_layout_algorithms.h
 #pragma once
 
+#include "force_layout.h"
+#include "layered_layout.h"
 #include "view.h"
 
+#include <functional>
+#include <string>
 #include <vector>
 
+using LayoutAlgorithm = void (*)(View &);
+
 /*
  * dfs_grid_layout takes a view and returns a view with node positions
  * determined.
@@ -13,6 +19,25 @@
  * algorithm to access
  */
 void dfs_grid_layout(View &);
+/*
+ * The layout called name ("dfs", "layered" or "force"), nullptr if there is
+ * none
+ */
+LayoutAlgorithm find_layout_algorithm(const std::string &name);
 void expand_node(View &view, NodeBase *node);
-void collapse_node(View &view, NodeBase *node);
+/*
+ * Hides the children of node that have no other expanded parent, and returns
+ * the ones that were shown.  Only changes which nodes are shown, the caller
+ * lays the view out.
+ */
+std::vector<NodeBase *> collapse_node(View &view, NodeBase *node);
+/*
+ * Shows the collapsed nodes again where they are, and adds them to the
+ * positions a layout returned, going to where node ends up, for the animation
+ * of them going into it.  They are not part of the grid: hide them again once
+ * the animation is over.
+ */
+void gather_collapsed_nodes(View &view, NodeBase *node,
+                            const std::vector<NodeBase *> &collapsed,
+                            std::vector<NodePosition> &positions);
 std::vector<NodeBase*> get_nodes_to_collapse(const View&, NodeBase*);
@@ -0,0 +1,511 @@
+// layered_layout.cc
+
+#include "layered_layout.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+using namespace std;
+
+/*
+ * The layout works on its own dense numbering of the visible nodes (sorted by
+ * id, so the result doesn't depend on the hashing of the logicalSubView),
+ * followed by the dummy vertices that long edges are split into.
+ */
+using Vertex = uint32_t;
+using VertexEdge = pair<Vertex, Vertex>;
+
+static const Vertex no_vertex = UINT32_MAX;
+// passes of the crossing reduction, and passes without improvement to give up
+static const int max_sweeps = 24;
+static const int max_stale_sweeps = 4;
+static const int balance_passes = 7;
+static const double free_weight = 1e-3;
+// long edges are split into dummies, shortest first, up to this many per node
+static const size_t max_dummies_per_node = 4;
+
+/*
+ * Adjacency lists in one array: the neighbors of v are
+ * targets[offsets[v]] up to targets[offsets[v + 1]]
+ */
+struct VertexLists {
+  vector<size_t> offsets;
+  vector<Vertex> targets;
+
+  VertexLists(size_t vertex_count, const vector<VertexEdge> &edges,
+              bool reverse);
+  const Vertex *begin(Vertex v) const { return targets.data() + offsets[v]; }
+  const Vertex *end(Vertex v) const { return targets.data() + offsets[v + 1]; }
+  size_t size(Vertex v) const { return offsets[v + 1] - offsets[v]; }
+};
+
+VertexLists::VertexLists(size_t vertex_count, const vector<VertexEdge> &edges,
+                         bool reverse)
+    : offsets(vertex_count + 1, 0), targets(edges.size()) {
+  for (auto &&edge : edges) {
+    ++offsets[(reverse ? edge.second : edge.first) + 1];
+  }
+  partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  vector<size_t> next(offsets.begin(), offsets.end() - 1);
+  for (auto &&edge : edges) {
+    Vertex from = reverse ? edge.second : edge.first;
+    targets[next[from]++] = reverse ? edge.first : edge.second;
+  }
+}
+
+/*
+ * The edges between visible nodes, with the back edges of a DFS (started from
+ * the roots of the view) reversed so that what is left is acyclic.  Self calls
+ * are dropped.
+ */
+static vector<VertexEdge> acyclic_edges(const View &view,
+                                        const vector<NodeBase *> &nodes,
+                                        const vector<Vertex> &vertex_of) {
+  vector<VertexEdge> edges;
+  for (Vertex v = 0; v < nodes.size(); ++v) {
+    for (auto edge : nodes[v]->neighborhood.outgoing) {
+      Vertex head = vertex_of[edge->head->id];
+      if (head != no_vertex && head != v) {
+        edges.emplace_back(v, head);
+      }
+    }
+  }
+  VertexLists out(nodes.size(), edges, false);
+
+  enum { unvisited, on_stack, done };
+  vector<char> state(nodes.size(), unvisited);
+  vector<pair<Vertex, const Vertex *>> stack;
+  vector<VertexEdge> result;
+  result.reserve(edges.size());
+  auto visit = [&](Vertex start) {
+    if (start == no_vertex || state[start] != unvisited) {
+      return;
+    }
+    state[start] = on_stack;
+    stack.emplace_back(start, out.begin(start));
+    while (!stack.empty()) {
+      Vertex v = stack.back().first;
+      const Vertex *&next = stack.back().second;
+      if (next == out.end(v)) {
+        state[v] = done;
+        stack.pop_back();
+        continue;
+      }
+      Vertex head = *next++;
+      if (state[head] == on_stack) {
+        result.emplace_back(head, v);
+      } else {
+        result.emplace_back(v, head);
+      }
+      if (state[head] == unvisited) {
+        state[head] = on_stack;
+        stack.emplace_back(head, out.begin(head));
+      }
+    }
+  };
+  for (auto root : view.roots) {
+    visit(vertex_of[root->id]);
+  }
+  for (Vertex v = 0; v < nodes.size(); ++v) {
+    visit(v);
+  }
+  return result;
+}
+
+/*
+ * Longest path layering: a vertex goes one layer after the last of its
+ * predecessors.  Vertices without predecessors are then moved up to just
+ * before their first successor, so that a function called from deep down
+ * but never called itself doesn't sit in the first layer with a long edge.
+ */
+static vector<int> assign_layers(size_t vertex_count,
+                                 const vector<VertexEdge> &edges) {
+  VertexLists out(vertex_count, edges, false);
+  vector<size_t> in_degree(vertex_count, 0);
+  for (auto &&edge : edges) {
+    ++in_degree[edge.second];
+  }
+  vector<int> layer(vertex_count, 0);
+  vector<Vertex> ready;
+  for (Vertex v = 0; v < vertex_count; ++v) {
+    if (!in_degree[v]) {
+      ready.push_back(v);
+    }
+  }
+  vector<Vertex> sources = ready;
+  while (!ready.empty()) {
+    Vertex v = ready.back();
+    ready.pop_back();
+    for (auto head = out.begin(v); head != out.end(v); ++head) {
+      layer[*head] = max(layer[*head], layer[v] + 1);
+      if (!--in_degree[*head]) {
+        ready.push_back(*head);
+      }
+    }
+  }
+  for (auto v : sources) {
+    if (out.size(v)) {
+      int first = layer[*out.begin(v)];
+      for (auto head = out.begin(v); head != out.end(v); ++head) {
+        first = min(first, layer[*head]);
+      }
+      layer[v] = first - 1;
+    }
+  }
+  return layer;
+}
+
+/*
+ * The layered graph: every edge joins vertices in consecutive layers
+ */
+struct LayeredGraph {
+  size_t node_count; // vertices below it are nodes, the rest are dummies
+  vector<int> layer;
+  vector<vector<Vertex>> layers;
+  vector<uint32_t> position; // of each vertex in its layer
+  vector<VertexEdge> segments;
+
+  LayeredGraph(size_t node_count, vector<int> layer,
+               const vector<VertexEdge> &edges);
+  void set_positions(int l) {
+    for (uint32_t i = 0; i < layers[l].size(); ++i) {
+      position[layers[l][i]] = i;
+    }
+  }
+};
+
+/*
+ * Splits the long edges and puts the vertices in their layers in DFS order
+ * from the sources, so that the first order already keeps subtrees together.
+ * A graph with many long edges (say, recursion back to main) would need a
+ * number of dummies quadratic in the number of nodes, so only the shortest
+ * edges within a budget are kept, the rest don't take part in the ordering.
+ */
+LayeredGraph::LayeredGraph(size_t node_count, vector<int> layer_of,
+                           const vector<VertexEdge> &edges)
+    : node_count(node_count), layer(move(layer_of)) {
+  auto span = [this](const VertexEdge &edge) {
+    return size_t(layer[edge.second] - layer[edge.first]);
+  };
+  vector<VertexEdge> routed = edges;
+  stable_sort(routed.begin(), routed.end(),
+              [&span](const VertexEdge &a, const VertexEdge &b) {
+                return span(a) < span(b);
+              });
+  size_t dummies = 0;
+  for (size_t i = 0; i < routed.size(); ++i) {
+    dummies += span(routed[i]) - 1;
+    if (dummies > max_dummies_per_node * node_count) {
+      routed.resize(i);
+      break;
+    }
+  }
+  for (auto &&edge : routed) {
+    Vertex tail = edge.first;
+    for (int l = layer[edge.first] + 1; l < layer[edge.second]; ++l) {
+      Vertex dummy = layer.size();
+      layer.push_back(l);
+      segments.emplace_back(tail, dummy);
+      tail = dummy;
+    }
+    segments.emplace_back(tail, edge.second);
+  }
+  position.resize(layer.size());
+  layers.resize(layer.empty() ? 0
+                              : *max_element(layer.begin(), layer.end()) + 1);
+
+  VertexLists down(layer.size(), segments, false);
+  // every vertex of a DAG can be reached from one without predecessors
+  vector<bool> placed(layer.size(), false);
+  for (auto &&segment : segments) {
+    placed[segment.second] = true;
+  }
+  vector<Vertex> sources;
+  for (Vertex v = 0; v < node_count; ++v) {
+    if (!placed[v]) {
+      sources.push_back(v);
+    }
+  }
+  placed.assign(layer.size(), false);
+  vector<pair<Vertex, const Vertex *>> stack;
+  auto place = [&](Vertex v) {
+    placed[v] = true;
+    layers[layer[v]].push_back(v);
+    stack.emplace_back(v, down.begin(v));
+  };
+  for (auto v : sources) {
+    place(v);
+    while (!stack.empty()) {
+      Vertex top = stack.back().first;
+      const Vertex *&next = stack.back().second;
+      while (next != down.end(top) && placed[*next]) {
+        ++next;
+      }
+      if (next == down.end(top)) {
+        stack.pop_back();
+      } else {
+        place(*next++);
+      }
+    }
+  }
+  for (int l = 0; l < (int)layers.size(); ++l) {
+    set_positions(l);
+  }
+}
+
+/*
+ * Sorts layer l by the median position of each vertex's neighbors in the
+ * adjacent layer.  Vertices without neighbors there keep their slot, ties keep
+ * their current order.
+ */
+static void order_by_median(LayeredGraph &graph, int l,
+                            const VertexLists &adjacent) {
+  vector<Vertex> &layer = graph.layers[l];
+  vector<pair<double, Vertex>> keyed;
+  vector<size_t> slots;
+  vector<uint32_t> positions;
+  for (size_t i = 0; i < layer.size(); ++i) {
+    Vertex v = layer[i];
+    if (!adjacent.size(v)) {
+      continue;
+    }
+    positions.clear();
+    for (auto u = adjacent.begin(v); u != adjacent.end(v); ++u) {
+      positions.push_back(graph.position[*u]);
+    }
+    size_t middle = positions.size() / 2;
+    nth_element(positions.begin(), positions.begin() + middle, positions.end());
+    double median = positions[middle];
+    if (positions.size() % 2 == 0) {
+      median = (median + *max_element(positions.begin(),
+                                      positions.begin() + middle)) / 2;
+    }
+    keyed.emplace_back(median, v);
+    slots.push_back(i);
+  }
+  stable_sort(keyed.begin(), keyed.end(),
+              [](const pair<double, Vertex> &a, const pair<double, Vertex> &b) {
+                return a.first < b.first;
+              });
+  for (size_t k = 0; k < slots.size(); ++k) {
+    layer[slots[k]] = keyed[k].second;
+  }
+  graph.set_positions(l);
+}
+
+/*
+ * Crossings between layer l and the next: with the segments sorted by their
+ * upper end, a segment crosses every earlier one whose lower end is further
+ * down.  Those are counted with a Fenwick tree over the lower positions.
+ */
+static uint64_t count_crossings(const LayeredGraph &graph, int l,
+                                const VertexLists &down) {
+  size_t size = graph.layers[l + 1].size();
+  vector<uint64_t> tree(size + 1, 0);
+  vector<uint32_t> heads;
+  uint64_t crossings = 0;
+  uint64_t inserted = 0;
+  for (auto v : graph.layers[l]) {
+    heads.clear();
+    for (auto u = down.begin(v); u != down.end(v); ++u) {
+      heads.push_back(graph.position[*u]);
+    }
+    sort(heads.begin(), heads.end());
+    for (auto head : heads) {
+      uint64_t not_below = 0;
+      for (size_t i = head + 1; i; i -= i & -i) {
+        not_below += tree[i];
+      }
+      crossings += inserted - not_below;
+      for (size_t i = head + 1; i <= size; i += i & -i) {
+        ++tree[i];
+      }
+      ++inserted;
+    }
+  }
+  return crossings;
+}
+
+static uint64_t count_crossings(const LayeredGraph &graph,
+                                const VertexLists &down) {
+  uint64_t crossings = 0;
+  for (int l = 0; l + 1 < (int)graph.layers.size(); ++l) {
+    crossings += count_crossings(graph, l, down);
+  }
+  return crossings;
+}
+
+/*
+ * Alternates sweeps down and up the layers and keeps the order with the
+ * fewest crossings
+ */
+static void reduce_crossings(LayeredGraph &graph, const VertexLists &up,
+                             const VertexLists &down) {
+  int layer_count = graph.layers.size();
+  uint64_t best = count_crossings(graph, down);
+  vector<vector<Vertex>> best_layers = graph.layers;
+  int stale = 0;
+  for (int sweep = 0; sweep < max_sweeps && best && stale < max_stale_sweeps;
+       ++sweep) {
+    if (sweep % 2 == 0) {
+      for (int l = 1; l < layer_count; ++l) {
+        order_by_median(graph, l, up);
+      }
+    } else {
+      for (int l = layer_count - 2; l >= 0; --l) {
+        order_by_median(graph, l, down);
+      }
+    }
+    uint64_t crossings = count_crossings(graph, down);
+    if (crossings < best) {
+      best = crossings;
+      best_layers = graph.layers;
+      stale = 0;
+    } else {
+      ++stale;
+    }
+  }
+  graph.layers.swap(best_layers);
+  for (int l = 0; l < layer_count; ++l) {
+    graph.set_positions(l);
+  }
+}
+
+/*
+ * Moves the vertices of a layer as close as possible (weighted least squares)
+ * to the desired tops while keeping their order and the gaps between them.
+ * With the gaps taken out this is an isotonic regression, solved by pooling
+ * adjacent violators.
+ */
+static void place_in_order(const vector<Vertex> &layer,
+                           const vector<double> &desired,
+                           const vector<double> &weight,
+                           const vector<double> &gap, vector<double> &y) {
+  vector<double> offset(layer.size());
+  for (size_t i = 1; i < layer.size(); ++i) {
+    offset[i] = offset[i - 1] + gap[layer[i - 1]];
+  }
+  // vertices that end up packed together: weighted sum of targets, total
+  // weight and count
+  struct Block {
+    double sum;
+    double weight;
+    size_t count;
+    double top() const { return sum / weight; }
+  };
+  vector<Block> blocks;
+  for (size_t i = 0; i < layer.size(); ++i) {
+    blocks.push_back(
+        {weight[i] * (desired[i] - offset[i]), weight[i], size_t(1)});
+    while (blocks.size() > 1) {
+      Block &last = blocks[blocks.size() - 1];
+      Block &before = blocks[blocks.size() - 2];
+      if (before.top() <= last.top()) {
+        break;
+      }
+      before.sum += last.sum;
+      before.weight += last.weight;
+      before.count += last.count;
+      blocks.pop_back();
+    }
+  }
+  size_t i = 0;
+  for (auto &&block : blocks) {
+    for (size_t end = i + block.count; i < end; ++i) {
+      y[layer[i]] = block.top() + offset[i];
+    }
+  }
+}
+
+/*
+ * Passes over the layers, alternating direction, that pull every vertex
+ * towards the mean center of its neighbors in the layer the pass comes from.
+ * The first pass goes up from the last layer, so parents get centered on
+ * their children, the next one lets the children follow, and so on.
+ */
+static vector<double> assign_rows(const View &view, const LayeredGraph &graph,
+                                  const vector<double> &height,
+                                  const VertexLists &up,
+                                  const VertexLists &down) {
+  size_t node_count = graph.node_count;
+  vector<double> gap(height.size());
+  for (Vertex v = 0; v < height.size(); ++v) {
+    gap[v] = height[v] +
+             (v < node_count ? view.row_spacing : view.node_margin);
+  }
+  vector<double> y(height.size(), 0);
+  for (auto &&layer : graph.layers) {
+    for (size_t i = 1; i < layer.size(); ++i) {
+      y[layer[i]] = y[layer[i - 1]] + gap[layer[i - 1]];
+    }
+  }
+  auto center = [&](Vertex v) { return y[v] + height[v] / 2; };
+  vector<double> desired;
+  vector<double> weight;
+  int layer_count = graph.layers.size();
+  for (int pass = 0; pass < balance_passes; ++pass) {
+    bool upwards = pass % 2 == 0;
+    const VertexLists &adjacent = upwards ? down : up;
+    for (int k = 1; k < layer_count; ++k) {
+      const auto &layer = graph.layers[upwards ? layer_count - 1 - k : k];
+      desired.clear();
+      weight.clear();
+      for (auto v : layer) {
+        double sum = 0;
+        for (auto u = adjacent.begin(v); u != adjacent.end(v); ++u) {
+          sum += center(*u);
+        }
+        size_t count = adjacent.size(v);
+        desired.push_back((count ? sum / count : center(v)) - height[v] / 2);
+        // well connected vertices give way less, and the ones with nothing
+        // to follow on this side just make room
+        weight.push_back(count ? count : free_weight);
+      }
+      place_in_order(layer, desired, weight, gap, y);
+    }
+  }
+  return y;
+}
+
+void layered_layout(View &view) {
+  // the boxes are moved behind the back of the incremental grid layout
+  view.grid.invalidate();
+  view.spatial_index.invalidate();
+  view.layout_moves.all = true;
+  vector<NodeBase *> nodes(view.logicalSubView.begin(),
+                           view.logicalSubView.end());
+  sort(nodes.begin(), nodes.end(),
+       [](NodeBase *a, NodeBase *b) { return a->id < b->id; });
+  vector<Vertex> vertex_of(view.name_to_node->size(), no_vertex);
+  for (Vertex v = 0; v < nodes.size(); ++v) {
+    vertex_of[nodes[v]->id] = v;
+  }
+
+  vector<VertexEdge> edges = acyclic_edges(view, nodes, vertex_of);
+  LayeredGraph graph(nodes.size(), assign_layers(nodes.size(), edges), edges);
+  VertexLists up(graph.layer.size(), graph.segments, true);
+  VertexLists down(graph.layer.size(), graph.segments, false);
+  reduce_crossings(graph, up, down);
+
+  vector<double> height(graph.layer.size(), 0);
+  vector<double> layer_width(graph.layers.size(), 0);
+  for (Vertex v = 0; v < nodes.size(); ++v) {
+    const Extent &extent = view.viewData.at(nodes[v]).box->extent;
+    height[v] = extent.y;
+    layer_width[graph.layer[v]] =
+        max(layer_width[graph.layer[v]], extent.x);
+  }
+  vector<double> y = assign_rows(view, graph, height, up, down);
+  double top = nodes.empty() ? 0 : *min_element(y.begin(), y.end());
+
+  vector<double> layer_x(graph.layers.size(), 0);
+  for (size_t l = 1; l < layer_x.size(); ++l) {
+    layer_x[l] = layer_x[l - 1] + layer_width[l - 1] + view.column_spacing;
+  }
+  for (Vertex v = 0; v < nodes.size(); ++v) {
+    view.viewData.at(nodes[v]).box->position =
+        Point(layer_x[graph.layer[v]], y[v] - top);
+  }
+}
@@ -0,0 +1,15 @@
+// layered_layout.h
+#pragma once
+
+#include "view.h"
+
+/*
+ * layered_layout is a Sugiyama style layout of the logicalSubView: cycles are
+ * broken by reversing the DFS back edges, every node is put in a layer (a
+ * column, calls go left to right like in dfs_grid_layout), edges spanning
+ * several layers go through dummy nodes, the order in each layer is swept
+ * with the median heuristic to reduce crossings, and the nodes are then moved
+ * towards their neighbors without changing the order.
+ * Like dfs_grid_layout, it expects the node boxes to have their extents set.
+ */
+void layered_layout(View &);
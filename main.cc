@@ -1,5 +1,6 @@
 // main.cc
 
+#include "binary_graph.h"
 #include "drawingarea_zoom_drag.h"
 #include "geometry.h"
 #include "graph.h"
@@ -9,31 +10,34 @@
 #include "view_filters.h"
 
 #include <gtkmm-3.0/gtkmm.h>
+#include <pango/pangocairo.h>
 
 #include <algorithm>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <unordered_set>
 
 using namespace std;
 
-Rectangle get_view_box(const DrawingArea_ZoomDrag &drawingArea_ZoomDrag) {
-  Rectangle view_box(Point(0, 0),
-                     Point(move(get_extent(drawingArea_ZoomDrag))));
-  drawingArea_ZoomDrag.user_to_image(view_box);
-  return view_box;
-}
-
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  if (argc < 2 || argc > 3) {
+    return usage();
+  }
+  LayoutAlgorithm layout_algorithm =
+      find_layout_algorithm(argc > 2 ? argv[2] : "dfs");
+  if (!layout_algorithm) {
     return usage();
   }
   /*
    * Getting the underlying graph.
    * TODO Persistance and multiple views (view views in a view tree)
    */
-  Graph graph = parseCallGraphFromFile(argv[1]);
+  Graph graph = is_binary_call_graph_file(argv[1])
+                    ? loadBinaryCallGraphFromFile(argv[1])
+                    : parseCallGraphFromFile(argv[1]);
   dump_call_graph(graph, cerr); // Useful for debug type of stuff...
 
   /*
@@ -51,30 +55,103 @@ int main(int argc, char *argv[]) {
    * TODO Relevant edge info => implies parsing more interesting graphs =>
    * building more useful interface to clang
    */
-  View view(&graph.name_to_node);
+  View view(&graph.names, &graph.name_to_node);
 
   MyState myState;
   Glib::RefPtr<Gtk::Application> app = Gtk::Application::create();
   Gtk::Window window;
   DrawingArea_ZoomDrag drawingArea_ZoomDrag;
   window.add(drawingArea_ZoomDrag);
-  PLayout layout =
-      Pango::Layout::create(drawingArea_ZoomDrag.get_pango_context());
+  LabelCache labels(drawingArea_ZoomDrag.get_pango_context());
 
-  initialize_view(graph, view, layout);
+  initialize_view(graph, view, labels);
   prune_isolated_nodes(view);
-  dfs_grid_layout(view);
 
-  drawingArea_ZoomDrag.zoomed_draw = [&view, &layout, &myState,
+  /*
+   * Layouts run off the GTK thread, the window shows up (and stays
+   * responsive) while they compute.  The force layout gives up as soon as
+   * a newer layout is asked for.
+   */
+  LayoutWorker layoutWorker;
+  ViewTransform layout_view = [&layoutWorker, layout_algorithm](View &v) {
+    if (layout_algorithm == find_layout_algorithm("force")) {
+      ForceLayoutOptions options;
+      options.cancel = layoutWorker.cancel_flag();
+      force_directed_layout(v, options);
+    } else {
+      layout_algorithm(v);
+    }
+  };
+  layoutWorker.run(view, layout_view,
+                   [&view, &drawingArea_ZoomDrag](
+                       vector<NodePosition> &positions) {
+                     set_positions(view, positions);
+                     view.physicalSubView.force_recalculate = true;
+                     drawingArea_ZoomDrag.invalidate_tiles();
+                     drawingArea_ZoomDrag.queue_draw();
+                   });
+
+  /*
+   * A frame is prepared once and then drawn tile by tile.  While an animation
+   * runs every frame is different, those are drawn without the tiles.
+   */
+  drawingArea_ZoomDrag.prepare_draw = [&view, &myState, &drawingArea_ZoomDrag](
+                                           const Rectangle &area) {
+    // check that our physical view covers the drawing area, the tiles'
+    // snapshot is of the old one
+    if (check_physicalSubView(view, area)) {
+      drawingArea_ZoomDrag.invalidate_snapshot();
+    }
+    return !myState.viewAnimation.is_valid();
+  };
+  drawingArea_ZoomDrag.zoomed_draw = [&view, &labels, &myState,
                                       &drawingArea_ZoomDrag](CContext c) {
-    Rectangle view_box = get_view_box(drawingArea_ZoomDrag);
-    View *rview = &view;
-    if (++myState.viewAnimation) {
-      rview = &myState.viewAnimation.current_view;
+    double scale = drawingArea_ZoomDrag.get_scale();
+    if (myState.viewAnimation.is_valid()) {
+      // the moving boxes would have the index updated on every frame
+      return draw_view(view, view.physicalSubView.nodes, c, labels, scale);
     }
-    // check that our physical view covers the drawing area
-    check_physicalSubView(*rview, view_box);
-    return draw_view(*rview, c, layout);
+    LogicalSubView nodes;
+    view.spatial_index.query(view, draw_reach(c, scale), nodes);
+    return draw_view(view, nodes, c, labels, scale);
+  };
+  // the hovered node changes too often to be drawn in the tiles
+  drawingArea_ZoomDrag.overlay_draw = [&view, &myState](CContext c) {
+    draw_highlight(view, myState.hovered, c);
+  };
+  /*
+   * Tiles coming into view are drawn on the tile worker from a copy of the
+   * physicalSubView, taken once for all of them until the view changes.  The
+   * first tile indexes the copy, the others look their nodes up in it.  Each
+   * of the worker's threads shapes labels in a cache of its own.
+   */
+  struct Snapshot {
+    View view;
+    once_flag indexed;
+  };
+  Pango::FontDescription font =
+      drawingArea_ZoomDrag.get_pango_context()->get_font_description();
+  double resolution = pango_cairo_context_get_resolution(
+      drawingArea_ZoomDrag.get_pango_context()->gobj());
+  drawingArea_ZoomDrag.snapshot_draw = [&view, font, resolution]() {
+    auto snapshot = make_shared<Snapshot>();
+    snapshot->view = copy_physicalView(view);
+    return [snapshot, font, resolution](CContext c) {
+      static thread_local unique_ptr<LabelCache> labels;
+      if (!labels) {
+        labels.reset(
+            new LabelCache(create_pango_context(c, font, resolution)));
+      }
+      // the tile's scale, the snapshot serves every zoom level
+      double dx = 0, dy = 1;
+      c->user_to_device_distance(dx, dy);
+      View &copy = snapshot->view;
+      call_once(snapshot->indexed,
+                [&copy]() { copy.spatial_index.sync(copy); });
+      LogicalSubView nodes;
+      copy.spatial_index.query(draw_reach(c, dy), nodes);
+      return draw_view(copy, nodes, c, *labels, dy);
+    };
   };
 
   drawingArea_ZoomDrag.signal_button_press_event().connect(
@@ -90,18 +167,26 @@ int main(int argc, char *argv[]) {
             expand_node(view, node);
             DIAGNOSTIC << "expanding node animation: " << node << endl;
             myState.viewAnimation.init(drawingArea_ZoomDrag, view,
-                                       dfs_grid_layout, [](View &v) {});
+                                       layoutWorker, layout_view);
           } else {
-            // collapse the node
-            auto nodes_to_collapse = get_nodes_to_collapse(view, node);
+            /*
+             * Collapse the node right away, like expand_node, so a later
+             * click that supersedes this layout still sees it collapsed.
+             * Only the animation of the children going into it can be
+             * dropped, when the layout is merged into a newer one.
+             */
+            auto collapsed = collapse_node(view, node);
             myState.viewAnimation.init(
-                drawingArea_ZoomDrag, view,
-                [&,node](View &lview) { collapse_node(lview, node); },
-                [nodes_to_collapse](View &lview) {
-                  for (auto lnode : nodes_to_collapse) {
-                  cout << "must erase node: " << lnode << endl;
+                drawingArea_ZoomDrag, view, layoutWorker, layout_view,
+                [node, collapsed](View &lview,
+                                  vector<NodePosition> &positions) {
+                  gather_collapsed_nodes(lview, node, collapsed, positions);
+                },
+                [collapsed](View &lview) {
+                  for (auto lnode : collapsed) {
                     lview.logicalSubView.erase(lnode);
                     lview.physicalSubView.nodes.erase(lnode);
+                    lview.spatial_index.moved(lnode);
                   }
                 });
           }
@@ -113,13 +198,55 @@ int main(int argc, char *argv[]) {
   drawingArea_ZoomDrag.signal_motion_notify_event().connect(
       [&](GdkEventMotion *e) {
         // DIAGNOSTIC << "motion lambda" << endl;
-        if (myState.nodeClick) {
+        if (myState.nodeClick &&
+            (layoutWorker.busy() || myState.viewAnimation.is_valid())) {
+          // the node is about to be moved to where the layout puts it, a
+          // drag would be lost
+          drawingArea_ZoomDrag.clear_dragTarget();
+        } else if (myState.nodeClick) {
           drawingArea_ZoomDrag.set_dragTarget(
               view.viewData[myState.nodeClick.node].box);
+          // the box moves after this handler, the index reads it when queried
+          // and the layout worker with the next request
+          view.spatial_index.moved(myState.nodeClick.node);
+          layoutWorker.moved(myState.nodeClick.node);
+          add_to_physicalView(view, myState.nodeClick.node);
+          // redraw where the node and its edges were, the handler below does
+          // where they end up
+          for (auto &&area : node_drawing_area(view, myState.nodeClick.node)) {
+            drawingArea_ZoomDrag.queue_draw_image_area(area);
+          }
+        } else if (!(e->state & GDK_BUTTON1_MASK)) {
+          // hovering: shade the node under the pointer, its full name in the
+          // tooltip
+          Point pointer(e->x, e->y);
+          drawingArea_ZoomDrag.user_to_image(pointer);
+          Node *was_hovered = myState.hovered;
+          if (myState.set_hovered(find_node(view, pointer))) {
+            for (auto node : {was_hovered, myState.hovered}) {
+              auto data = view.viewData.find(node);
+              if (data != view.viewData.end() && data->second.box) {
+                drawingArea_ZoomDrag.queue_draw_window_area(
+                    *data->second.box);
+              }
+            }
+            drawingArea_ZoomDrag.set_tooltip_text(
+                myState.hovered ? myState.hovered->fullname : "");
+          }
         }
         return false;
       },
       false);
+  drawingArea_ZoomDrag.signal_motion_notify_event().connect(
+      [&](GdkEventMotion *) {
+        if (myState.nodeClick) {
+          for (auto &&area : node_drawing_area(view, myState.nodeClick.node)) {
+            drawingArea_ZoomDrag.queue_draw_image_area(area);
+          }
+        }
+        return false;
+      },
+      true);
 
   window.set_default_size(800, 800);
   window.show_all();
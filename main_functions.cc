@@ -1,6 +1,10 @@
 // main_functions.cc
 
 #include "main_functions.h"
+
+#include <pango/pangocairo.h>
+
+#include <limits>
 #include <vector>
 
 using namespace std;
@@ -60,11 +64,53 @@ bool MyState::handle_event_click(Node *node, GdkEventButton *e) {
   return false;
 }
 
-void initialize_view(const Graph &graph, View &view, PLayout &layout) {
+bool MyState::set_hovered(Node *node) {
+  if (node == hovered) {
+    return false;
+  }
+  hovered = node;
+  return true;
+}
+
+LabelCache::LabelCache(Glib::RefPtr<Pango::Context> context, size_t capacity)
+    : context_(context), capacity_(max<size_t>(capacity, 1)),
+      scratch_(Pango::Layout::create(context)) {}
+
+PLayout LabelCache::get(const NodeBase *node, const string &text) {
+  auto found = layout_of_.find(node);
+  if (found != layout_of_.end()) {
+    recent_.splice(recent_.begin(), recent_, found->second);
+    return found->second->second;
+  }
+  PLayout layout;
+  if (layout_of_.size() < capacity_) {
+    layout = Pango::Layout::create(context_);
+  } else {
+    // reuse the least recently drawn one
+    layout_of_.erase(recent_.back().first);
+    layout = move(recent_.back().second);
+    recent_.pop_back();
+  }
+  layout->set_text(text);
+  recent_.emplace_front(node, layout);
+  layout_of_[node] = recent_.begin();
+  return layout;
+}
+
+PLayout LabelCache::scratch(const string &text) {
+  scratch_->set_text(text);
+  return scratch_;
+}
+
+void initialize_view(const Graph &graph, View &view, LabelCache &labels) {
+  view.roots = (move(graph.get_roots()));
+  set_logicalView(view, view.roots);
   for (auto node : graph.nodes) {
     string text = remove_qualifiers(node->fullname);
     view.viewData[node].text = text;
-    layout->set_text(text);
+    PLayout layout = view.logicalSubView.count(node)
+                         ? labels.get(node, text)
+                         : labels.scratch(text);
     Pango::Rectangle r = layout->get_pixel_ink_extents();
     Extent extent(2 * view.node_margin + r.get_width(),
                   2 * view.node_margin + r.get_height());
@@ -73,95 +119,266 @@ void initialize_view(const Graph &graph, View &view, PLayout &layout) {
     DIAGNOSTIC << "initialized: " << text << " : " << node << " : "
                << *view.viewData[node].box << endl;
   }
-  view.roots = (move(graph.get_roots()));
-  set_logicalView(view, view.roots);
 }
 
-void draw_node_rectangle(const View &view, NodeBase *node, CContext c,
-                         PLayout layout) {
+const double default_line_width = 2; // cairo's
+const double expanded_line_factor = 3;
+const double degree_circle_radius = 5;
+
+// how far the outlines and degree circles draw_node draws stick out of a box
+const double node_overhang =
+    max(expanded_line_factor * default_line_width / 2, degree_circle_radius);
+// and how far edges stick out of the segment between their ends
+const double edge_overhang = default_line_width / 2;
+
+void draw_node_rectangle_outline(const View &view, NodeBase *node,
+                                 CContext c) {
   const Point &point = view.viewData.at(node).box->position;
   const Extent &extent = view.viewData.at(node).box->extent;
   if (view.viewData.at(node).expanded) {
-    c->set_line_width(3 * c->get_line_width());
+    c->set_line_width(expanded_line_factor * c->get_line_width());
   }
-  // rectangle
   c->rectangle(point.x, point.y, extent.x, extent.y);
   c->stroke();
+}
+
+void draw_node_rectangle(const View &view, NodeBase *node, CContext c,
+                         LabelCache &labels) {
+  const Point &point = view.viewData.at(node).box->position;
+  // rectangle
+  draw_node_rectangle_outline(view, node, c);
   // text
   c->move_to(point.x + view.node_margin / 2.0,
              point.y + view.node_margin / 2.0);
-  layout->set_text(view.viewData.at(node).text);
-  layout->show_in_cairo_context(c);
+  labels.get(node, view.viewData.at(node).text)->show_in_cairo_context(c);
 }
 
 void draw_node_in_circle(const View &view, NodeBase *node, CContext c,
-                         PLayout layout) {
+                         LabelCache &) {
   // circles for incoming
   if (node->out_degree()) {
     Point right_m = view.viewData.at(node).box->Right().MidPoint();
     c->set_source_rgb(0, 1, 0);
-    c->arc(right_m.x, right_m.y, 5, 0, 2 * PI);
+    c->arc(right_m.x, right_m.y, degree_circle_radius, 0, 2 * PI);
     c->fill();
     c->stroke();
   }
 }
 
 void draw_node_out_circle(const View &view, NodeBase *node, CContext c,
-                          PLayout layout) {
+                          LabelCache &) {
   // circles for outgoing
   if (node->in_degree()) {
     Point right_m = view.viewData.at(node).box->Left().MidPoint();
     c->set_source_rgb(1, 0, 0);
-    c->arc(right_m.x, right_m.y, 5, 0, 2 * PI);
+    c->arc(right_m.x, right_m.y, degree_circle_radius, 0, 2 * PI);
     c->fill();
     c->stroke();
   }
 }
 
 typedef void (*draw_function)(const View &view, NodeBase *node, CContext c,
-                              PLayout layout);
+                              LabelCache &labels);
 
 const vector<draw_function> draw_functions = {
     draw_node_rectangle, draw_node_in_circle, draw_node_out_circle};
 
 void draw_node(const View &view, const NodeBase *cnode, CContext c,
-               PLayout layout) {
+               LabelCache &labels) {
   NodeBase *node = const_cast<NodeBase *>(cnode);
   for (auto fn : draw_functions) {
     c->save();
-    fn(view, node, c, layout);
+    fn(view, node, c, labels);
     c->restore();
   }
 }
 
-void draw_edge(const View &view, const EdgeBase *edge, CContext c) {
-  LineSegment physicalEdge = PhysicalEdge(view, *edge);
-  c->move_to(physicalEdge.u.x, physicalEdge.u.y);
-  c->line_to(physicalEdge.v.x, physicalEdge.v.y);
-  c->stroke();
+/*
+ * Level of detail, in pixels on the screen
+ */
+const double min_text_height = 6; // smaller labels can't be read
+const double min_box_size = 3;    // smaller boxes are drawn as dots
+const double min_edge_length = 1;
+
+// the clip of c, grown by what is drawn past a box or an edge
+static Rectangle grown_clip(CContext c, double scale, double overhang) {
+  double x0, y0, x1, y1;
+  c->get_clip_extents(x0, y0, x1, y1);
+  double reach = overhang + 1 / scale; // and a pixel of antialiasing
+  return Rectangle(Point(x0 - reach, y0 - reach),
+                   Extent(x1 - x0 + 2 * reach, y1 - y0 + 2 * reach));
 }
 
-bool draw_view(const View &view, CContext c, PLayout layout) {
-  unordered_set<EdgeBase *> drawn_edges;
-  for (auto &&node : view.physicalSubView.nodes) {
-    draw_node(view, node, c, layout);
-    // the nodes of the physical subview are calculated based on whether or not
-    // their edges intersect the view, so this should work...
+Rectangle draw_reach(CContext c, double scale) {
+  return grown_clip(c, scale, max(node_overhang, edge_overhang));
+}
+
+// the scale below which draw_view draws the node as a dot
+static double dot_scale(const View &view, const NodeBase *node) {
+  const Rectangle &box = *view.viewData.at(const_cast<NodeBase *>(node)).box;
+  double text_height = box.extent.y - 2 * view.node_margin;
+  double box_size = min(box.extent.x, box.extent.y);
+  double infinity = numeric_limits<double>::infinity();
+  return min(text_height > 0 ? min_text_height / text_height : infinity,
+             box_size > 0 ? min_box_size / box_size : infinity);
+}
+
+bool draw_view(const View &view, const LogicalSubView &nodes, CContext c,
+               LabelCache &labels, double scale) {
+  // all the dots and all the edges go in one path each, filled or stroked
+  // once
+  vector<const Rectangle *> dots;
+  vector<LineSegment> edges;
+  // only what reaches into the clip is drawn, e.g. a tile's part of the view
+  Rectangle node_clip = grown_clip(c, scale, node_overhang);
+  Rectangle edge_clip = grown_clip(c, scale, edge_overhang);
+  for (auto &&node : nodes) {
+    if (!view.physicalSubView.nodes.count(node)) {
+      continue;
+    }
+    // the nodes of the physical subview are calculated based on whether or
+    // not their edges intersect the view, so this should work...  Each edge
+    // is drawn once, from its tail.
     for (auto edge : node->neighborhood.outgoing) {
-      if (view.logicalSubView.count(edge->tail) &&
-          view.logicalSubView.count(edge->head) && !drawn_edges.count(edge)) {
-        draw_edge(view, edge, c);
-        drawn_edges.insert(edge);
+      if (view.logicalSubView.count(edge->head)) {
+        LineSegment physicalEdge = PhysicalEdge(view, *edge);
+        if (max(abs(physicalEdge.v.x - physicalEdge.u.x),
+                abs(physicalEdge.v.y - physicalEdge.u.y)) *
+                    scale >=
+                min_edge_length &&
+            edge_clip.Overlaps(physicalEdge)) {
+          edges.push_back(physicalEdge);
+        }
       }
     }
+    const Rectangle &box = *view.viewData.at(node).box;
+    double text_height = box.extent.y - 2 * view.node_margin;
+    bool dot = text_height * scale < min_text_height &&
+               min(box.extent.x, box.extent.y) * scale < min_box_size;
+    if (!node_clip.Overlaps(box)) {
+      continue;
+    }
+    if (dot) {
+      dots.push_back(&box);
+    } else if (text_height * scale >= min_text_height) {
+      draw_node(view, node, c, labels);
+    } else {
+      c->save();
+      draw_node_rectangle_outline(view, node, c);
+      c->restore();
+    }
   }
+  c->save();
+  for (auto box : dots) {
+    c->rectangle(box->position.x, box->position.y, box->extent.x,
+                 box->extent.y);
+  }
+  c->fill();
+  c->restore();
+  c->save();
+  for (auto &&edge : edges) {
+    c->move_to(edge.u.x, edge.u.y);
+    c->line_to(edge.v.x, edge.v.y);
+  }
+  // counted over the whole physicalSubView, so every tile agrees
+  const vector<double> &dot_scales = view.physicalSubView.dot_scales;
+  size_t dot_count = dot_scales.end() -
+                     upper_bound(dot_scales.begin(), dot_scales.end(), scale);
+  if (dot_count * 2 > dot_scales.size()) {
+    // mostly dots: thin, see-through edges, so where they bunch up shows
+    // instead of a black smear
+    c->set_line_width(1 / scale);
+    c->set_source_rgba(0, 0, 0, 0.3);
+  }
+  c->stroke();
+  c->restore();
   return false;
 }
 
+void draw_highlight(const View &view, const NodeBase *node, CContext c) {
+  auto data = view.viewData.find(const_cast<NodeBase *>(node));
+  if (!node || data == view.viewData.end() || !data->second.box ||
+      !view.physicalSubView.nodes.count(const_cast<NodeBase *>(node))) {
+    return;
+  }
+  const Rectangle &box = *data->second.box;
+  c->save();
+  c->set_source_rgba(0, 0, 1, 0.2);
+  c->rectangle(box.position.x, box.position.y, box.extent.x, box.extent.y);
+  c->fill();
+  c->restore();
+}
+
+View copy_physicalView(const View &view) {
+  View copy(view.names, view.name_to_node);
+  copy.node_margin = view.node_margin;
+  copy.row_spacing = view.row_spacing;
+  copy.column_spacing = view.column_spacing;
+  copy.physicalSubView.nodes = view.physicalSubView.nodes;
+  copy.physicalSubView.box = view.physicalSubView.box;
+  copy.physicalSubView.force_recalculate = false;
+  copy.physicalSubView.dot_scales = view.physicalSubView.dot_scales;
+  auto copy_node = [&view, &copy](NodeBase *node) {
+    const NodeViewData &data = view.viewData.at(node);
+    if (copy.viewData
+            .emplace(node, NodeViewData{make_shared<Rectangle>(*data.box),
+                                        data.text, data.expanded})
+            .second) {
+      copy.logicalSubView.insert(node);
+    }
+  };
+  for (auto node : view.physicalSubView.nodes) {
+    copy_node(node);
+    for (auto edge : node->neighborhood.outgoing) {
+      if (view.logicalSubView.count(edge->head)) {
+        copy_node(edge->head);
+      }
+    }
+  }
+  return copy;
+}
+
+View copy_logicalView(const View &view) {
+  View copy(view.names, view.name_to_node);
+  copy.node_margin = view.node_margin;
+  copy.row_spacing = view.row_spacing;
+  copy.column_spacing = view.column_spacing;
+  copy.logicalSubView = view.logicalSubView;
+  copy.roots = view.roots;
+  copy.viewData.reserve(view.logicalSubView.size());
+  for (auto node : view.logicalSubView) {
+    const NodeViewData &data = view.viewData.at(node);
+    copy.viewData.emplace(
+        node, NodeViewData{make_shared<Rectangle>(*data.box), "",
+                           data.expanded});
+  }
+  return copy;
+}
+
+void set_positions(View &view, const vector<NodePosition> &positions) {
+  for (auto &&position : positions) {
+    auto data = view.viewData.find(position.first);
+    if (data != view.viewData.end() && data->second.box) {
+      data->second.box->position = position.second;
+      view.spatial_index.moved(position.first);
+    }
+  }
+}
+
+Glib::RefPtr<Pango::Context>
+create_pango_context(CContext c, const Pango::FontDescription &font,
+                     double resolution) {
+  auto context = Pango::Layout::create(c)->get_context();
+  context->set_font_description(font);
+  pango_cairo_context_set_resolution(context->gobj(), resolution);
+  return context;
+}
+
 int usage() {
-  cout << "usage: ./graph <filename>" << endl;
+  cout << "usage: ./graph <filename> [layout]" << endl;
   cout << "  The filename should indicate a file created with get_call_graph"
        << endl;
+  cout << "  layout is dfs (the default), layered or force" << endl;
   return 1;
 }
 
@@ -178,84 +395,283 @@ bool check_physicalSubView(View &view, Rectangle view_box) {
   view_box.position -= view_box.extent / 2.0;
   view_box.extent *= 2;
   set_physicalView(view, view_box);
+  vector<double> &dot_scales = view.physicalSubView.dot_scales;
+  dot_scales.clear();
+  for (auto node : view.physicalSubView.nodes) {
+    dot_scales.push_back(dot_scale(view, node));
+  }
+  sort(dot_scales.begin(), dot_scales.end());
   return true;
 }
 
-Node *find_node(const View &view, const Point &point) {
-  auto result = find_if(view.physicalSubView.nodes.begin(),
-                        view.physicalSubView.nodes.end(),
-                        [&point, &view](NodeBase *node) {
-                          return view.viewData.at(node).box->Contains(point);
-                        });
-  return result == view.physicalSubView.nodes.end()
-             ? nullptr
-             : dynamic_cast<Node *>(*result);
+vector<Rectangle> node_drawing_area(const View &view, const NodeBase *node) {
+  vector<Rectangle> area;
+  auto data = view.viewData.find(const_cast<NodeBase *>(node));
+  if (data == view.viewData.end() || !data->second.box) {
+    return area;
+  }
+  auto add = [&area](Rectangle box, double overhang) {
+    box.position -= Point(overhang, overhang);
+    box.extent += Extent(2 * overhang, 2 * overhang);
+    area.push_back(box);
+  };
+  add(*data->second.box, node_overhang);
+  for (auto &&segment : PhysicalNeighborhood(view, *node)) {
+    Point low(min(segment.u.x, segment.v.x), min(segment.u.y, segment.v.y));
+    add(Rectangle(low, Extent(abs(segment.v.x - segment.u.x),
+                              abs(segment.v.y - segment.u.y))),
+        edge_overhang);
+  }
+  return area;
 }
 
-// t \in [0,1]
-Point linear_animate(const Point &start, const Point &end, double cur_t,
-                     double max_t) {
-  return ((max_t - cur_t) * start + (cur_t)*end) / max_t;
+Node *find_node(View &view, const Point &point) {
+  return as_node(view.spatial_index.node_at(view, point));
 }
 
-bool ViewAnimation::is_finished() const {
-  // if (time_period > 0) return time >= final_time;
-  // return time_period > 0 ? time >= final_time : time <= 0;
-  return time >= final_time;
+double linear_curve(double t) { return t; }
+
+double ease_in_out_curve(double t) {
+  return t < 0.5 ? 4 * t * t * t : 1 - 4 * (1 - t) * (1 - t) * (1 - t);
 }
 
-bool ViewAnimation::is_valid() const { return final_time && time_period; }
+double ease_out_curve(double t) { return 1 - (1 - t) * (1 - t) * (1 - t); }
+
+Point interpolate(const Point &start, const Point &end, double t) {
+  return (1 - t) * start + t * end;
+}
+
+bool ViewAnimation::is_finished() const { return time >= final_time; }
+
+bool ViewAnimation::is_valid() const { return final_time; }
 
 ViewAnimation::operator bool() const { return is_valid() && !is_finished(); }
 
-ViewAnimation &ViewAnimation::operator++() {
+void ViewAnimation::advance(int64_t frame_time) {
   if (!is_valid()) {
     DIAGNOSTIC << " ViewAnimation no longer valid" << endl;
-    return *this;
+    return;
   }
-  for (auto node :
-       current_view.physicalSubView.nodes) { // current vs final may be problem
-    current_view.viewData.at(node).box->position = linear_animate(
-        initial_view.viewData.at(node).box->position,
-        final_view.viewData.at(node).box->position, time, final_time);
+  if (start_frame_time < 0) {
+    start_frame_time = frame_time;
   }
-  time += time_period;
-  return *this;
-};
+  time = (frame_time - start_frame_time) / 1000.0;
+  double t = curve(min(time / final_time, 1.0));
+  /*
+   * The spatial index only indexes the moved boxes again when it's queried
+   * (a click or hover), the frames don't query it.  Nodes that move into the
+   * physical view are added to it instead.
+   */
+  PhysicalSubView &physical = view->physicalSubView;
+  for (auto &&moving : moves) {
+    moving.box->position = interpolate(moving.start, moving.end, t);
+    view->spatial_index.moved(moving.node);
+    if (physical.box.Overlaps(*moving.box)) {
+      physical.nodes.insert(moving.node);
+    }
+  }
+}
+
+LayoutWorker::LayoutWorker()
+    : cancel_(false), stop_(false), latest_request_(0),
+      delivered_request_(0) {
+  dispatcher_.connect([this]() { deliver(); });
+  thread_ = thread(&LayoutWorker::work, this);
+}
+
+LayoutWorker::~LayoutWorker() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+    cancel_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void LayoutWorker::run(View &view, ViewTransform transform, Done done) {
+  unique_ptr<Job> job(new Job{nullptr, {}, move(transform), move(done),
+                              ++latest_request_, {}});
+  if (!view.grid.valid) {
+    job->view.reset(new View(copy_logicalView(view)));
+    view.grid.valid = true;
+  } else {
+    for (auto node : view.grid.changed) {
+      job->changes.push_back({node, bool(view.logicalSubView.count(node)),
+                              *view.viewData.at(node).box});
+    }
+    for (auto node : moved_) {
+      job->changes.push_back({node, bool(view.logicalSubView.count(node)),
+                              *view.viewData.at(node).box});
+    }
+  }
+  view.grid.changed.clear();
+  moved_.clear();
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (pending_ && !job->view) {
+      // never ran, what it would have told the copy is still to be told
+      job->view = move(pending_->view);
+      job->changes.insert(job->changes.begin(), pending_->changes.begin(),
+                          pending_->changes.end());
+    }
+    pending_ = move(job);
+    cancel_ = true;
+  }
+  wake_.notify_one();
+}
+
+void LayoutWorker::work() {
+  for (;;) {
+    unique_ptr<Job> job;
+    {
+      unique_lock<mutex> lock(mutex_);
+      wake_.wait(lock, [this]() { return stop_ || pending_; });
+      if (stop_) {
+        return;
+      }
+      job = move(pending_);
+      cancel_ = false;
+    }
+    if (job->view) {
+      view_ = move(*job->view);
+      job->view.reset();
+    }
+    for (auto &&change : job->changes) {
+      auto &box = view_.viewData[change.node].box;
+      if (box) {
+        *box = change.box;
+      } else {
+        box = make_shared<Rectangle>(change.box);
+      }
+      if (change.visible ? view_.logicalSubView.insert(change.node).second
+                         : view_.logicalSubView.erase(change.node)) {
+        view_.grid.changed.push_back(change.node);
+      }
+    }
+    job->changes.clear();
+    view_.layout_moves.clear();
+    job->transform(view_);
+    /*
+     * Even a superseded layout has moved the boxes of the copy, so its
+     * result is delivered too, the newer layout goes on from there
+     */
+    auto add = [this, &job](NodeBase *node) {
+      job->positions.emplace_back(node, view_.viewData.at(node).box->position);
+    };
+    if (view_.layout_moves.all) {
+      job->positions.reserve(view_.logicalSubView.size());
+      for_each(view_.logicalSubView.begin(), view_.logicalSubView.end(), add);
+    } else {
+      for_each(view_.layout_moves.nodes.begin(),
+               view_.layout_moves.nodes.end(), add);
+    }
+    unique_ptr<Job> undelivered;
+    {
+      lock_guard<mutex> lock(mutex_);
+      undelivered = move(finished_);
+    }
+    if (undelivered) {
+      // the GTK thread gets both, where a node is in both the newer counts
+      unordered_set<NodeBase *> newer;
+      for (auto &&position : job->positions) {
+        newer.insert(position.first);
+      }
+      for (auto &&position : undelivered->positions) {
+        if (!newer.count(position.first)) {
+          job->positions.push_back(position);
+        }
+      }
+    }
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (stop_) {
+        return;
+      }
+      finished_ = move(job);
+    }
+    dispatcher_.emit();
+  }
+}
 
-void ViewAnimation::init(Gtk::DrawingArea &da, View &view,
-                         ViewTransform transform, ViewTransform cleanup) {
+void LayoutWorker::deliver() {
+  unique_ptr<Job> job;
+  {
+    lock_guard<mutex> lock(mutex_);
+    job = move(finished_);
+  }
+  if (job) {
+    delivered_request_ = job->request;
+    job->done(job->positions);
+  }
+}
+
+void ViewAnimation::init(DrawingArea_ZoomDrag &da, View &view,
+                         LayoutWorker &worker, ViewTransform transform,
+                         PositionsTransform arrange, ViewTransform cleanup) {
   DIAGNOSTIC << "initing animation" << endl;
+  worker.run(view, move(transform),
+             [&da, &view, arrange, cleanup,
+              this](vector<NodePosition> &positions) {
+               start(da, view, positions, arrange, cleanup);
+             });
+}
+
+void ViewAnimation::start(DrawingArea_ZoomDrag &da, View &view,
+                          vector<NodePosition> &positions,
+                          PositionsTransform arrange, ViewTransform cleanup) {
+  DIAGNOSTIC << "starting animation" << endl;
+  if (is_valid()) {
+    this->cleanup(view);
+    da.remove_tick_callback(tick_id);
+  }
+  arrange(view, positions);
+  // the view keeps its boxes (a drag target holds one), they move from where
+  // they are now, a running animation stops there
+  moves.clear();
+  for (auto &&position : positions) {
+    auto data = view.viewData.find(position.first);
+    if (data != view.viewData.end() && data->second.box &&
+        data->second.box->position != position.second) {
+      moves.push_back({position.first, data->second.box.get(),
+                       data->second.box->position, position.second});
+    }
+  }
+  this->view = &view;
+  this->cleanup = cleanup;
   view.physicalSubView.force_recalculate = true;
-  initial_view = move(view);
-  current_view = initial_view;
-  current_view.detach_node_boxes();
-  final_view = initial_view;
-  final_view.detach_node_boxes();
-  transform(final_view);
+  da.invalidate_tiles();
   set_default_timing();
-  Glib::signal_timeout().connect(
-      [&,cleanup,this]() {
+  tick_id = da.add_tick_callback(
+      [&da, this](const Glib::RefPtr<Gdk::FrameClock> &clock) {
+        advance(clock->get_frame_time());
         da.queue_draw();
         if (is_finished()) {
-          DIAGNOSTIC << "cleaning up" << endl;
-          cleanup(final_view);
-          DIAGNOSTIC << "moving" << endl;
-          view = move(final_view);
-          invalidate();
+          finish(da);
+          return false;
         }
-        return !is_finished();
-      },
-      time_period);
+        return true;
+      });
+}
+
+void ViewAnimation::finish(DrawingArea_ZoomDrag &da) {
+  DIAGNOSTIC << "cleaning up" << endl;
+  for (auto &&moving : moves) {
+    moving.box->position = moving.end;
+    view->spatial_index.moved(moving.node);
+  }
+  cleanup(*view);
+  view->physicalSubView.force_recalculate = true;
+  da.invalidate_tiles();
+  moves.clear();
+  invalidate();
 }
 
 void ViewAnimation::set_default_timing() {
   time = 0;
   final_time = 1000;
-  time_period = 20;
+  start_frame_time = -1;
+  curve = ease_in_out_curve;
 }
 
-void ViewAnimation::invalidate() {
-  final_time = 0;
-  time_period = 0;
-}
+void ViewAnimation::invalidate() { final_time = 0; }
@@ -11,12 +11,24 @@
 #include <gtkmm-3.0/gtkmm.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <regex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using ViewTransform = std::function<void(View&)>;
+using PositionsTransform =
+    std::function<void(View &, std::vector<NodePosition> &)>;
 
 using Milliseconds = double;
 
@@ -36,37 +48,185 @@ struct NodeClickInfo {
   explicit operator bool() { return node && e; }
 };
 
+/*
+ * Runs layouts on a worker thread, so the GTK main loop keeps drawing while a
+ * large view is laid out.  The worker keeps a copy of the view's logical part
+ * (copy_logicalView) with the grid, and each request only sends what changed
+ * since the last one.  done gets, on the GTK thread (through a
+ * Glib::Dispatcher), the nodes the layout moved and where to.
+ *
+ * A request that hasn't started when a newer one comes in is merged into it,
+ * layouts that look at cancel_flag() stop early, and a result the GTK thread
+ * hasn't taken yet is merged into the next one.  Construct it after
+ * Gtk::Application::create.
+ */
+class LayoutWorker {
+public:
+  using Done = std::function<void(std::vector<NodePosition> &)>;
+
+  LayoutWorker();
+  LayoutWorker(const LayoutWorker &) = delete;
+  LayoutWorker &operator=(const LayoutWorker &) = delete;
+  ~LayoutWorker();
+
+  /*
+   * Lays out the worker's copy of view with transform.  The copy is taken
+   * whole when view.grid isn't valid, otherwise it's told about the nodes in
+   * view.grid.changed and the ones reported with moved.  Clears
+   * view.grid.changed.
+   */
+  void run(View &view, ViewTransform transform, Done done);
+  // a box moved on the GTK thread (e.g. dragged), sent with the next request
+  void moved(NodeBase *node) { moved_.insert(node); }
+  // set while the running layout has been superseded
+  const std::atomic<bool> *cancel_flag() const { return &cancel_; }
+  // whether the result of the latest request is still to come
+  bool busy() const { return delivered_request_ != latest_request_; }
+
+private:
+  // a node shown, hidden or moved on the GTK thread
+  struct NodeChange {
+    NodeBase *node;
+    bool visible;
+    Rectangle box;
+  };
+  struct Job {
+    std::unique_ptr<View> view; // replaces the copy when set
+    std::vector<NodeChange> changes;
+    ViewTransform transform;
+    Done done;
+    uint64_t request;
+    std::vector<NodePosition> positions; // the result
+  };
+
+  void work();
+  void deliver();
+
+  Glib::Dispatcher dispatcher_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::unique_ptr<Job> pending_;  // next to run
+  std::unique_ptr<Job> finished_; // waiting for the GTK thread
+  std::atomic<bool> cancel_;
+  bool stop_;
+  View view_; // the copy, only used on the worker thread
+  std::unordered_set<NodeBase *> moved_; // only used on the GTK thread
+  uint64_t latest_request_; // likewise
+  uint64_t delivered_request_; // likewise
+  std::thread thread_;
+};
+
+/*
+ * Shaped Pango layouts of the node labels, so that redrawing a node doesn't
+ * shape its text again.  A layout is made the first time its node is drawn,
+ * and past capacity the least recently drawn ones are dropped.  A layout of a
+ * short label is a few KB, capacity bounds the memory the cache takes.
+ */
+class LabelCache {
+public:
+  explicit LabelCache(Glib::RefPtr<Pango::Context> context,
+                      size_t capacity = 4096);
+
+  // the layout of the node's label, text is only shaped when it's not cached
+  PLayout get(const NodeBase *node, const std::string &text);
+  // a layout for measuring text that isn't drawn, reused by every call
+  PLayout scratch(const std::string &text);
+  size_t size() const { return layout_of_.size(); }
+
+private:
+  using Entry = std::pair<const NodeBase *, PLayout>;
+
+  Glib::RefPtr<Pango::Context> context_;
+  size_t capacity_;
+  std::list<Entry> recent_; // most recently drawn first
+  std::unordered_map<const NodeBase *, std::list<Entry>::iterator> layout_of_;
+  PLayout scratch_;
+};
+
+/*
+ * Animation curves, from the part of the duration passed to the part of the
+ * way done, both going from 0 to 1
+ */
+using Curve = std::function<double(double)>;
+double linear_curve(double t);
+double ease_in_out_curve(double t); // cubic, slow start and end
+double ease_out_curve(double t);    // cubic, fast start, slow end
+// the point the part t of the way from start to end
+Point interpolate(const Point &start, const Point &end, double t);
+
+/*
+ * Moves the nodes from where they are in the view to where a layout put them.
+ * start keeps just the nodes that move with their start and end positions,
+ * which every frame interpolates in place, in the view's own boxes.
+ *
+ * The frames come from the widget's frame clock (a tick callback), so they
+ * are paced by the display, and the positions follow the frame time: a frame
+ * that takes too long makes the next one jump ahead, skipping the frames
+ * that were missed, so the animation takes final_time however loaded the
+ * machine is.
+ */
 struct ViewAnimation {
-  View final_view;
-  View initial_view;
-  View current_view;
+  struct Move {
+    NodeBase *node;
+    Rectangle *box; // in view
+    Point start;
+    Point end;
+  };
+
+  std::vector<Move> moves;
+  View *view; // being animated
+  // done to the view at the end, tells its spatial index what it changes
+  ViewTransform cleanup;
+  Curve curve;
 
-  Milliseconds time;
+  Milliseconds time; // since the first frame
   Milliseconds final_time;
-  Milliseconds time_period;
+  int64_t start_frame_time; // in microseconds, -1 before the first frame
+  unsigned tick_id;
 
-  ViewAnimation() : time(0), final_time(0), time_period(0) {} // uninitialized
+  ViewAnimation()
+      : view(nullptr), time(0), final_time(0), start_frame_time(-1),
+        tick_id(0) {} // uninitialized
   ViewAnimation(const ViewAnimation &) = delete;
   ViewAnimation(ViewAnimation &&) = default;
   ViewAnimation &operator=(const ViewAnimation &) = delete;
   ViewAnimation &operator=(ViewAnimation &&) = default;
 
-  void init(Gtk::DrawingArea &, View &, ViewTransform,
+  /*
+   * Lays out the view with transform on the worker, then animates the view to
+   * the result, which arrange can add to first
+   */
+  void init(DrawingArea_ZoomDrag &, View &, LayoutWorker &, ViewTransform,
+            PositionsTransform arrange = [](View &,
+                                            std::vector<NodePosition> &) {},
             ViewTransform cleanup = [](View &) {});
+  /*
+   * Starts moving the view's boxes to the positions.  A running animation is
+   * cut short first, its cleanup is done to the view.
+   */
+  void start(DrawingArea_ZoomDrag &, View &,
+             std::vector<NodePosition> &positions, PositionsTransform arrange,
+             ViewTransform cleanup);
+  // moves the nodes to where they are at frame_time (from the frame clock)
+  void advance(int64_t frame_time);
+  // puts the nodes where they end up and does the cleanup
+  void finish(DrawingArea_ZoomDrag &);
   void set_default_timing();
   void invalidate();
 
   bool is_valid() const;
   bool is_finished() const;
   explicit operator bool() const;
-  ViewAnimation &operator++();
 };
 
 struct MyState {
   NodeClickInfo nodeClick;
   NodeClickInfo node2Click;
   ViewAnimation viewAnimation;
+  Node *hovered = nullptr; // under the pointer
   bool handle_event_click(Node *, GdkEventButton *e);
+  // returns whether the hovered node changed
+  bool set_hovered(Node *);
   DragTarget get_motion_target() const;
 };
 
@@ -74,22 +234,73 @@ int usage();
 
 std::string remove_qualifiers(const Fullname &fullname);
 
-void initialize_view(const Graph &graph, View &view, PLayout &layout);
+/*
+ * Sets the labels and measures the boxes.  The labels of the nodes that start
+ * out visible stay shaped in labels.
+ */
+void initialize_view(const Graph &graph, View &view, LabelCache &labels);
 void expand_node_transform(View &);
 void contract_node_transform(View &);
 
 void draw_node(const View &view, const NodeBase *node, CContext c,
-               PLayout layout);
-void draw_edge(const View &view, const EdgeBase *edge, CContext c);
-bool draw_view(const View &view, CContext c, PLayout layout);
+               LabelCache &labels);
+/*
+ * Draws the physicalSubView with as much detail as shows at scale (pixels per
+ * unit, see DrawingArea_ZoomDrag::get_scale): labels too small to read are
+ * left out, boxes too small to tell apart become dots, and edges shorter
+ * than a pixel are skipped.  Only what reaches into the clip of c is drawn,
+ * out of nodes: all the nodes with a box or an edge there have to be in it,
+ * e.g. from the spatial index queried with draw_reach.
+ */
+bool draw_view(const View &view, const LogicalSubView &nodes, CContext c,
+               LabelCache &labels, double scale);
+// what draw_view draws in the clip of c can reach from this area
+Rectangle draw_reach(CContext c, double scale);
+// shades the node, if it is in the physicalSubView
+void draw_highlight(const View &view, const NodeBase *node, CContext c);
+/*
+ * A copy of what draw_view reads: the physicalSubView with boxes of its own,
+ * and the boxes of the nodes its edges go to, so it can be drawn on another
+ * thread while the view changes.
+ */
+View copy_physicalView(const View &view);
+/*
+ * A copy of what a layout reads and writes: the logicalSubView with boxes of
+ * its own, and the roots.  The rest of the view is left out, see LayoutWorker
+ * for what comes back.
+ */
+View copy_logicalView(const View &view);
+// puts the boxes where a layout put them, without an animation
+void set_positions(View &view, const std::vector<NodePosition> &positions);
+/*
+ * A Pango context for drawing labels on c that measures text like the
+ * widget's (same font and resolution).  For threads other than the GTK one,
+ * which can't use the widget's context.
+ */
+Glib::RefPtr<Pango::Context>
+create_pango_context(CContext c, const Pango::FontDescription &font,
+                     double resolution);
 
-Node *find_node(const View &view, const Point &point);
+/*
+ * The parts of the image the node and its edges are drawn on, which have to be
+ * drawn again when it moves or its looks change.  Empty for a node the view
+ * has no box for.
+ */
+std::vector<Rectangle> node_drawing_area(const View &view,
+                                         const NodeBase *node);
+
+/*
+ * The node under the point, looked up in the view's spatial index (which is
+ * why the view isn't const: moved nodes are indexed again first)
+ */
+Node *find_node(View &view, const Point &point);
 
 Extent get_extent(const Gtk::Widget &widget);
 
 /*
  * If the view box is not contained by the view box determined by the
  * physicalSubView.box, then a new one is calculated.  This is to prevent
- * calculating a new box for every tiny little change to the view.
+ * calculating a new box for every tiny little change to the view.  Returns
+ * whether it was, with its dot_scales.
  */
 bool check_physicalSubView(View &view, Rectangle view_box);
@@ -0,0 +1,25 @@
+// mapped_file.h
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+ * A read only memory mapping of a whole file.  If the file can't be mapped,
+ * data() is nullptr and the MappedFile is false.
+ */
+class MappedFile {
+  const char *data_;
+  size_t size_;
+
+public:
+  explicit MappedFile(const std::string &filename);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  const char *data() const { return data_; }
+  const char *end() const { return data_ + size_; }
+  size_t size() const { return size_; }
+  explicit operator bool() const { return data_; }
+};
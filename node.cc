@@ -4,8 +4,10 @@
 
 using namespace std;
 
+const string no_filename;
+
 ostream &operator<<(ostream &o, const SourceLocation &sourceLocation) {
-  return o << sourceLocation.filename << " " << sourceLocation.line << " "
+  return o << *sourceLocation.filename << " " << sourceLocation.line << " "
            << sourceLocation.column << " " << sourceLocation.offset;
 }
 
@@ -21,7 +23,7 @@ ostream &operator<<(ostream &o, const Node &node) {
 }
 
 ostream &operator<<(ostream &o, const Edge &edge) {
-  Node *tail = dynamic_cast<Node *>(edge.tail);
-  Node *head = dynamic_cast<Node *>(edge.head);
+  const Node *tail = as_node(edge.tail);
+  const Node *head = as_node(edge.head);
   return o << tail->fullname << " -> " << head->fullname << " " << edge.range;
 }
@@ -7,14 +7,17 @@
 
 struct Edge;
 
+// the filename of a location that has none
+extern const std::string no_filename;
+
 struct SourceLocation {
-  std::string filename;
+  const std::string *filename; // interned in the graph's file table
   size_t line;
   size_t column;
   size_t offset;
 
-  SourceLocation() : line(0), column(0), offset(0) {}
-  SourceLocation(const std::string &filename, size_t line, size_t column,
+  SourceLocation() : filename(&no_filename), line(0), column(0), offset(0) {}
+  SourceLocation(const std::string *filename, size_t line, size_t column,
                  size_t offset)
       : filename(filename), line(line), column(column), offset(offset) {}
 };
@@ -26,19 +29,32 @@ struct SourceRange {
 
 class Node : public NodeBase {
 public:
-  Fullname fullname;
+  const Fullname &fullname; // interned in the graph's SymbolTable, at id
   SourceRange range;
-  Node(Fullname fullname) : fullname(fullname) {}
-  ~Node() {}
+  Node(NameId id, const Fullname &fullname)
+      : NodeBase(id), fullname(fullname) {}
 };
 
 class Edge : public EdgeBase {
 public:
-  SourceRange range;
-  Edge(Node *tail, Node *head) : EdgeBase(tail, head) {}
-  ~Edge() {}
+  SourceRange range; // of the first call site
+  size_t calls;      // number of call sites from tail to head
+  Edge(Node *tail, Node *head) : EdgeBase(tail, head), calls(1) {}
 };
 
+/*
+ * Every NodeBase in a Graph is a Node and every EdgeBase an Edge (nothing
+ * else derives from the bases), so these casts need no run time check.
+ */
+inline Node *as_node(NodeBase *node) { return static_cast<Node *>(node); }
+inline const Node *as_node(const NodeBase *node) {
+  return static_cast<const Node *>(node);
+}
+inline Edge *as_edge(EdgeBase *edge) { return static_cast<Edge *>(edge); }
+inline const Edge *as_edge(const EdgeBase *edge) {
+  return static_cast<const Edge *>(edge);
+}
+
 std::ostream &operator<<(std::ostream &, const SourceLocation &);
 std::ostream &operator<<(std::ostream &, const SourceRange &);
 std::ostream &operator<<(std::ostream &, const Node &);
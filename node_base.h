@@ -9,49 +9,75 @@
  * algorithms access to what they need to create views, and no more.
  */
 
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
-#include <list>
 #include <string>
 
 using Fullname = std::string;
+// names are interned in a SymbolTable, see symbol_table.h
+using NameId = uint32_t;
 
 class NodeBase;
 class EdgeBase;
 
+/*
+ * The edges of one node in one direction: a slice of the adjacency arrays the
+ * graph builds once all of its edges exist (see Graph::build_adjacency).
+ */
+class EdgeRange {
+  EdgeBase *const *begin_;
+  EdgeBase *const *end_;
+
+public:
+  EdgeRange() : begin_(nullptr), end_(nullptr) {}
+  EdgeRange(EdgeBase *const *begin, EdgeBase *const *end)
+      : begin_(begin), end_(end) {}
+
+  EdgeBase *const *begin() const { return begin_; }
+  EdgeBase *const *end() const { return end_; }
+  size_t size() const { return end_ - begin_; }
+  bool empty() const { return begin_ == end_; }
+};
+
 /*
  * Tempted to make an iterator for this... (don't do it!)
  */
 struct Neighborhood {
-  std::list<EdgeBase *> outgoing;
-  std::list<EdgeBase *> incoming;
+  EdgeRange outgoing;
+  EdgeRange incoming;
 };
 
+/*
+ * The bases are not polymorphic: no vtables, no RTTI.  They can only be
+ * constructed and destroyed as part of the node and edge types that derive
+ * from them, and the graph only ever holds one node type and one edge type,
+ * so code that knows the derived type can cast down statically.
+ */
 class NodeBase {
 public:
   Neighborhood neighborhood;
+  NameId id; // the index of the node in its graph, usable as a handle
   size_t in_degree() const { return neighborhood.incoming.size(); }
   size_t out_degree() const { return neighborhood.outgoing.size(); }
   size_t degree() const { return in_degree() + out_degree(); }
   bool is_isolated() const { return !degree(); }
-  virtual ~NodeBase() = 0;
+
+protected:
+  explicit NodeBase(NameId id) : id(id) {}
+  ~NodeBase() = default;
 };
 
 class EdgeBase {
 public:
   NodeBase *tail;
   NodeBase *head;
+
+protected:
   EdgeBase(NodeBase *tail, NodeBase *head) : tail(tail), head(head) {}
-  // virtual ~EdgeBase() = 0;
-  virtual ~EdgeBase(); // taking pure virtualness off for error throwing!
+  ~EdgeBase() = default;
 };
 
 inline std::ostream& operator<<(std::ostream &o, const EdgeBase &e) {
   return o << e.tail << " --> " << e.head;
 }
-
-/*
- * Just learned this trick.  Force the Bases to be abstract with purevirtual
- * destructor, but defined inline here so it will compile
- */
-inline NodeBase::~NodeBase() {}
-inline EdgeBase::~EdgeBase() {}
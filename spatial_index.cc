@@ -0,0 +1,294 @@
+// spatial_index.cc
+
+#include "spatial_index.h"
+#include "view.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+static const int max_level = 48;
+
+static uint64_t cell_key(int64_t x, int64_t y) {
+  return uint64_t(uint32_t(x)) << 32 | uint32_t(y);
+}
+
+static Rectangle bounds(const LineSegment &segment) {
+  Point low(min(segment.u.x, segment.v.x), min(segment.u.y, segment.v.y));
+  Point high(max(segment.u.x, segment.v.x), max(segment.u.y, segment.v.y));
+  return Rectangle(low, Extent(high.x - low.x, high.y - low.y));
+}
+
+void SpatialIndex::Bucket::add(NodeBase *node, const Rectangle &box) {
+  nodes.push_back(node);
+  boxes.push_back(box);
+}
+
+void SpatialIndex::Bucket::add(EdgeBase *edge, const LineSegment &segment) {
+  edges.push_back(edge);
+  segments.push_back(segment);
+}
+
+void SpatialIndex::Bucket::remove(NodeBase *node) {
+  size_t i = find(nodes.begin(), nodes.end(), node) - nodes.begin();
+  if (i < nodes.size()) {
+    nodes[i] = nodes.back();
+    nodes.pop_back();
+    boxes.remove(i);
+  }
+}
+
+void SpatialIndex::Bucket::remove(EdgeBase *edge) {
+  size_t i = find(edges.begin(), edges.end(), edge) - edges.begin();
+  if (i < edges.size()) {
+    edges[i] = edges.back();
+    edges.pop_back();
+    segments.remove(i);
+  }
+}
+
+SpatialIndex::CellRange SpatialIndex::cells(const Rectangle &bounds,
+                                            int level) const {
+  double size = ldexp(cell_size_, level);
+  return {level, int64_t(floor(bounds.position.x / size)),
+          int64_t(floor(bounds.position.y / size)),
+          int64_t(floor((bounds.position.x + bounds.extent.x) / size)),
+          int64_t(floor((bounds.position.y + bounds.extent.y) / size))};
+}
+
+SpatialIndex::CellRange SpatialIndex::cells(const Rectangle &bounds) const {
+  double size = max(bounds.extent.x, bounds.extent.y);
+  int level = 0;
+  while (level < max_level && ldexp(cell_size_, level) < size) {
+    ++level;
+  }
+  return cells(bounds, level);
+}
+
+// the segment PhysicalEdge draws, between the boxes the ends were indexed with
+LineSegment SpatialIndex::edge_segment(const EdgeBase *edge) const {
+  const Rectangle &tail = box_of_.at(edge->tail);
+  const Rectangle &head = box_of_.at(edge->head);
+  return LineSegment(
+      Point(tail.position.x + tail.extent.x,
+            tail.position.y + tail.extent.y / 2),
+      Point(head.position.x, head.position.y + head.extent.y / 2));
+}
+
+void SpatialIndex::insert(NodeBase *node) {
+  const Rectangle &box = box_of_.at(node);
+  CellRange range = cells(box);
+  if (levels_.size() <= size_t(range.level)) {
+    levels_.resize(range.level + 1);
+  }
+  Level &level = levels_[range.level];
+  for (int64_t x = range.x0; x <= range.x1; ++x) {
+    for (int64_t y = range.y0; y <= range.y1; ++y) {
+      level[cell_key(x, y)].add(node, box);
+    }
+  }
+}
+
+void SpatialIndex::insert(EdgeBase *edge) {
+  LineSegment segment = edge_segment(edge);
+  CellRange range = cells(bounds(segment));
+  if (levels_.size() <= size_t(range.level)) {
+    levels_.resize(range.level + 1);
+  }
+  Level &level = levels_[range.level];
+  for (int64_t x = range.x0; x <= range.x1; ++x) {
+    for (int64_t y = range.y0; y <= range.y1; ++y) {
+      level[cell_key(x, y)].add(edge, segment);
+    }
+  }
+}
+
+void SpatialIndex::remove(NodeBase *node) {
+  CellRange range = cells(box_of_.at(node));
+  Level &level = levels_.at(range.level);
+  for (int64_t x = range.x0; x <= range.x1; ++x) {
+    for (int64_t y = range.y0; y <= range.y1; ++y) {
+      auto bucket = level.find(cell_key(x, y));
+      if (bucket != level.end()) {
+        bucket->second.remove(node);
+        if (bucket->second.empty()) {
+          level.erase(bucket);
+        }
+      }
+    }
+  }
+}
+
+void SpatialIndex::remove(EdgeBase *edge) {
+  CellRange range = cells(bounds(edge_segment(edge)));
+  Level &level = levels_.at(range.level);
+  for (int64_t x = range.x0; x <= range.x1; ++x) {
+    for (int64_t y = range.y0; y <= range.y1; ++y) {
+      auto bucket = level.find(cell_key(x, y));
+      if (bucket != level.end()) {
+        bucket->second.remove(edge);
+        if (bucket->second.empty()) {
+          level.erase(bucket);
+        }
+      }
+    }
+  }
+}
+
+void SpatialIndex::build(const View &view) {
+  invalidate();
+  // level 0 cells about twice the size of a box
+  double sum = 0;
+  for (auto node : view.logicalSubView) {
+    const Extent &extent = view.viewData.at(node).box->extent;
+    sum += max(extent.x, extent.y);
+  }
+  cell_size_ = view.logicalSubView.empty()
+                   ? 1
+                   : max(1.0, 2 * sum / view.logicalSubView.size());
+  box_of_.reserve(view.logicalSubView.size());
+  for (auto node : view.logicalSubView) {
+    box_of_.emplace(node, *view.viewData.at(node).box);
+    insert(node);
+  }
+  for (auto node : view.logicalSubView) {
+    for (auto edge : node->neighborhood.outgoing) {
+      if (box_of_.count(edge->head)) {
+        insert(edge);
+      }
+    }
+  }
+  valid_ = true;
+}
+
+/*
+ * Takes the moved nodes and their edges out with the boxes they were indexed
+ * with, and puts them back in with the boxes they have now
+ */
+void SpatialIndex::update(const View &view) {
+  if (moved_.size() > box_of_.size() / 4) {
+    build(view);
+    return;
+  }
+  unordered_set<EdgeBase *> edges;
+  for (auto node : moved_) {
+    edges.insert(node->neighborhood.outgoing.begin(),
+                 node->neighborhood.outgoing.end());
+    edges.insert(node->neighborhood.incoming.begin(),
+                 node->neighborhood.incoming.end());
+  }
+  auto indexed = [this](const EdgeBase *edge) {
+    return box_of_.count(edge->tail) && box_of_.count(edge->head);
+  };
+  for (auto edge : edges) {
+    if (indexed(edge)) {
+      remove(edge);
+    }
+  }
+  for (auto node : moved_) {
+    if (box_of_.count(node)) {
+      remove(node);
+      box_of_.erase(node);
+    }
+  }
+  for (auto node : moved_) {
+    if (view.logicalSubView.count(node)) {
+      box_of_.emplace(node, *view.viewData.at(node).box);
+      insert(node);
+    }
+  }
+  for (auto edge : edges) {
+    if (indexed(edge)) {
+      insert(edge);
+    }
+  }
+  moved_.clear();
+}
+
+void SpatialIndex::sync(const View &view) {
+  if (valid_) {
+    update(view);
+  } else {
+    build(view);
+  }
+}
+
+void SpatialIndex::query(const View &view, const Rectangle &box,
+                         unordered_set<NodeBase *> &result) {
+  sync(view);
+  query(box, result);
+}
+
+void SpatialIndex::query(const Rectangle &box,
+                         unordered_set<NodeBase *> &result) const {
+  vector<uint8_t> mask; // for the overlaps tests
+  auto test = [&](const Bucket &bucket) {
+    mask.resize(max(bucket.nodes.size(), bucket.edges.size()));
+    overlaps(box, bucket.boxes, mask.data());
+    for (size_t i = 0; i < bucket.nodes.size(); ++i) {
+      if (mask[i]) {
+        result.insert(bucket.nodes[i]);
+      }
+    }
+    overlaps(box, bucket.segments, mask.data());
+    for (size_t i = 0; i < bucket.edges.size(); ++i) {
+      if (mask[i]) {
+        result.insert(bucket.edges[i]->tail);
+        result.insert(bucket.edges[i]->head);
+      }
+    }
+  };
+  for (int l = 0; l < int(levels_.size()); ++l) {
+    const Level &level = levels_[l];
+    if (level.empty()) {
+      continue;
+    }
+    CellRange range = cells(box, l);
+    double count =
+        double(range.x1 - range.x0 + 1) * double(range.y1 - range.y0 + 1);
+    if (count > level.size()) {
+      // zoomed out: fewer buckets than cells in view
+      for (auto &&cell : level) {
+        int64_t x = int32_t(cell.first >> 32);
+        int64_t y = int32_t(uint32_t(cell.first));
+        if (range.x0 <= x && x <= range.x1 && range.y0 <= y &&
+            y <= range.y1) {
+          test(cell.second);
+        }
+      }
+    } else {
+      for (int64_t x = range.x0; x <= range.x1; ++x) {
+        for (int64_t y = range.y0; y <= range.y1; ++y) {
+          auto cell = level.find(cell_key(x, y));
+          if (cell != level.end()) {
+            test(cell->second);
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+ * A point is in one cell per level, so this looks at a few buckets, cheap
+ * enough to run on every motion event
+ */
+NodeBase *SpatialIndex::node_at(const View &view, const Point &point) {
+  sync(view);
+  Rectangle at(point, Extent());
+  for (int l = 0; l < int(levels_.size()); ++l) {
+    CellRange range = cells(at, l);
+    auto cell = levels_[l].find(cell_key(range.x0, range.y0));
+    if (cell == levels_[l].end()) {
+      continue;
+    }
+    const Bucket &bucket = cell->second;
+    for (size_t i = 0; i < bucket.nodes.size(); ++i) {
+      if (at.Overlaps(bucket.boxes[i])) {
+        return bucket.nodes[i];
+      }
+    }
+  }
+  return nullptr;
+}
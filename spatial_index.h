@@ -0,0 +1,100 @@
+// spatial_index.h
+#pragma once
+
+#include "geometry.h"
+#include "node_base.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct View;
+
+/*
+ * An index over the boxes of the nodes in the logicalSubView and the edges
+ * between them, so set_physicalView only looks at what is near the view box.
+ *
+ * It is a hierarchy of uniform grids: level l has cells 2^l times as wide as
+ * level 0, whose cells are about the size of a box.  Each box or edge goes in
+ * the level where its bounding box spans at most two cells each way, so it is
+ * in at most 4 cells however long it is.  A query looks at the cells that
+ * overlap the view box on every level, which costs O(levels + visible) plus
+ * the long edges passing near (not through) the view.
+ *
+ * Code that moves a few boxes or shows or hides a few nodes reports them with
+ * moved, they are indexed again on the next query (an incremental layout
+ * reports the boxes it moved).  Code that moves all of them (a full layout)
+ * calls invalidate, and the index is rebuilt from scratch on the next query.
+ *
+ * Queries sync the index first, so they can't run on several threads at once;
+ * for that, sync it and use the const query.
+ */
+class SpatialIndex {
+public:
+  SpatialIndex() : valid_(false), cell_size_(1) {}
+
+  void invalidate() {
+    valid_ = false;
+    levels_.clear();
+    box_of_.clear();
+    moved_.clear();
+  }
+  void moved(NodeBase *node) {
+    if (valid_) {
+      moved_.insert(node);
+    }
+  }
+
+  /*
+   * Adds to result the nodes whose box overlaps the box, and the ends of the
+   * edges (between nodes in the logicalSubView) that pass through it
+   */
+  void query(const View &view, const Rectangle &box,
+             std::unordered_set<NodeBase *> &result);
+  // the same on an index synced with the view, which is left as it is
+  void query(const Rectangle &box,
+             std::unordered_set<NodeBase *> &result) const;
+  // a node whose box contains the point, nullptr if there is none
+  NodeBase *node_at(const View &view, const Point &point);
+  // indexes the moved boxes again, or all of them if it was invalidated
+  void sync(const View &view);
+
+private:
+  // the shapes are kept next to the items, for the batched overlaps tests
+  struct Bucket {
+    std::vector<NodeBase *> nodes;
+    Rectangles boxes;
+    std::vector<EdgeBase *> edges;
+    LineSegments segments;
+
+    void add(NodeBase *node, const Rectangle &box);
+    void add(EdgeBase *edge, const LineSegment &segment);
+    void remove(NodeBase *node);
+    void remove(EdgeBase *edge);
+    bool empty() const { return nodes.empty() && edges.empty(); }
+  };
+  using Level = std::unordered_map<uint64_t, Bucket>;
+  // the cells covering a bounding box on one level
+  struct CellRange {
+    int level;
+    int64_t x0, y0, x1, y1;
+  };
+
+  void build(const View &view);
+  void update(const View &view);
+  CellRange cells(const Rectangle &bounds) const;
+  CellRange cells(const Rectangle &bounds, int level) const;
+  LineSegment edge_segment(const EdgeBase *edge) const;
+  void insert(NodeBase *node);
+  void insert(EdgeBase *edge);
+  void remove(NodeBase *node);
+  void remove(EdgeBase *edge);
+
+  bool valid_;
+  double cell_size_; // of level 0
+  std::vector<Level> levels_;
+  // the box each node was indexed with, the nodes in here are the ones indexed
+  std::unordered_map<NodeBase *, Rectangle> box_of_;
+  std::unordered_set<NodeBase *> moved_;
+};
@@ -0,0 +1,84 @@
+// symbol_table.cc
+
+#include "symbol_table.h"
+
+#include <cstring>
+
+using namespace std;
+
+const NameId SymbolTable::npos;
+
+// 64 bit FNV-1a
+static uint64_t hash_name(const char *s, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(s[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/*
+ * Returns the slot holding the name, or the empty slot where it would go
+ */
+size_t SymbolTable::find_slot(const char *s, size_t size,
+                              uint64_t hash) const {
+  size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    NameId slot = slots_[i];
+    if (!slot) {
+      return i;
+    }
+    const Fullname &name = names_[slot - 1];
+    if (hashes_[slot - 1] == hash && name.size() == size &&
+        !memcmp(name.data(), s, size)) {
+      return i;
+    }
+  }
+}
+
+void SymbolTable::grow() {
+  vector<NameId> slots(slots_.empty() ? 64 : 2 * slots_.size(), 0);
+  size_t mask = slots.size() - 1;
+  for (NameId id = 0; id < names_.size(); ++id) {
+    size_t i = hashes_[id] & mask;
+    while (slots[i]) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = id + 1;
+  }
+  slots_.swap(slots);
+}
+
+void SymbolTable::reserve(size_t count) {
+  hashes_.reserve(count);
+  while (2 * count > slots_.size()) {
+    grow();
+  }
+}
+
+pair<NameId, bool> SymbolTable::intern(const char *s, size_t size) {
+  // keep the load factor at or below one half
+  if (2 * (names_.size() + 1) > slots_.size()) {
+    grow();
+  }
+  uint64_t hash = hash_name(s, size);
+  size_t i = find_slot(s, size, hash);
+  if (slots_[i]) {
+    return {slots_[i] - 1, false};
+  }
+  NameId id = names_.size();
+  names_.emplace_back(s, size);
+  hashes_.push_back(hash);
+  slots_[i] = id + 1;
+  return {id, true};
+}
+
+NameId SymbolTable::find(const Fullname &s) const {
+  if (slots_.empty()) {
+    return npos;
+  }
+  NameId slot =
+      slots_[find_slot(s.data(), s.size(), hash_name(s.data(), s.size()))];
+  return slot ? slot - 1 : npos;
+}
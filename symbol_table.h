@@ -0,0 +1,40 @@
+// symbol_table.h
+#pragma once
+
+#include "node_base.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Interns names so each one is stored once and can be referred to by a
+ * NameId.  Ids are handed out densely, in order of first appearance, and the
+ * strings never move, so references returned by name() stay valid for the
+ * lifetime of the table.
+ */
+class SymbolTable {
+  std::deque<Fullname> names_;
+  std::vector<uint64_t> hashes_; // hash of each name, indexed by id
+  std::vector<NameId> slots_;    // open addressing, id + 1 or 0 when empty
+
+  size_t find_slot(const char *s, size_t size, uint64_t hash) const;
+  void grow();
+
+public:
+  static const NameId npos = NameId(-1);
+
+  // returns the id of the name, and whether it was added
+  std::pair<NameId, bool> intern(const char *s, size_t size);
+  std::pair<NameId, bool> intern(const Fullname &s) {
+    return intern(s.data(), s.size());
+  }
+  // npos if the name has not been interned
+  NameId find(const Fullname &s) const;
+
+  const Fullname &name(NameId id) const { return names_[id]; }
+  size_t size() const { return names_.size(); }
+  void reserve(size_t count);
+};
@@ -0,0 +1,159 @@
+// tu_cache.cc
+
+#include "tu_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+// bump when the entry layout or the record format changes
+static const string cache_magic = "get_call_graph cache 1";
+
+ContentHash hash_bytes(const char *data, size_t size, ContentHash hash) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool read_file(const string &filename, string &contents) {
+  ifstream file(filename, ios::binary);
+  if (!file) {
+    return false;
+  }
+  ostringstream oss;
+  oss << file.rdbuf();
+  contents = oss.str();
+  return true;
+}
+
+bool FileHashes::get(const string &filename, ContentHash &hash) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    auto kv = hashes_.find(filename);
+    if (kv != hashes_.end()) {
+      hash = kv->second.second;
+      return kv->second.first;
+    }
+  }
+  // hash outside of the lock, at worst two threads hash the same file
+  string contents;
+  bool ok = read_file(filename, contents);
+  ContentHash result = ok ? hash_bytes(contents.data(), contents.size()) : 0;
+  lock_guard<mutex> lock(mutex_);
+  hashes_[filename] = {ok, result};
+  hash = result;
+  return ok;
+}
+
+TUCache::TUCache(const string &directory) : directory_(directory) {
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+    cerr << "couldn't create cache directory: " << directory_ << endl;
+  }
+}
+
+string TUCache::entry_path(const CompileCommand &command) const {
+  ContentHash key = hash_bytes(nullptr, 0);
+  for (auto &&arg : command) {
+    // include the terminator so that {"ab", "c"} and {"a", "bc"} differ
+    key = hash_bytes(arg.c_str(), arg.size() + 1, key);
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.tu", (unsigned long long)key);
+  return directory_ + "/" + name;
+}
+
+/*
+ * Entry layout:
+ *   cache_magic
+ *   <number of args>
+ *   <arg> (one per line)
+ *   <number of dependencies>
+ *   <hash> <filename> (one per line)
+ *   <records>
+ */
+bool TUCache::load(const CompileCommand &command, string &records) {
+  ifstream entry(entry_path(command), ios::binary);
+  string line;
+  if (!getline(entry, line) || line != cache_magic) {
+    return false;
+  }
+
+  size_t size;
+  if (!(entry >> size) || size != command.size()) {
+    return false;
+  }
+  entry.ignore(1);
+  for (auto &&arg : command) {
+    if (!getline(entry, line) || line != arg) {
+      return false;
+    }
+  }
+
+  if (!(entry >> size)) {
+    return false;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    ContentHash recorded;
+    ContentHash current;
+    string filename;
+    if (!(entry >> hex >> recorded >> dec)) {
+      return false;
+    }
+    entry.ignore(1);
+    if (!getline(entry, filename) || !file_hashes_.get(filename, current) ||
+        current != recorded) {
+      return false;
+    }
+  }
+
+  ostringstream oss;
+  oss << entry.rdbuf();
+  records = oss.str();
+  return true;
+}
+
+void TUCache::store(const CompileCommand &command,
+                    const vector<string> &dependencies,
+                    const string &records) {
+  ostringstream entry;
+  entry << cache_magic << "\n" << command.size() << "\n";
+  for (auto &&arg : command) {
+    entry << arg << "\n";
+  }
+  entry << dependencies.size() << "\n";
+  for (auto &&filename : dependencies) {
+    ContentHash hash;
+    if (!file_hashes_.get(filename, hash)) {
+      // can't validate the entry later, so don't write it
+      return;
+    }
+    entry << hex << hash << dec << " " << filename << "\n";
+  }
+  entry << records;
+
+  // write and rename so a reader never sees a partial entry
+  string path = entry_path(command);
+  string tmp =
+      path + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+  {
+    ofstream file(tmp, ios::binary);
+    file << entry.str();
+    if (!file) {
+      cerr << "couldn't write cache entry: " << tmp << endl;
+      remove(tmp.c_str());
+      return;
+    }
+  }
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+  }
+}
@@ -0,0 +1,57 @@
+// tu_cache.h
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * An on-disk cache of the records get_call_graph extracts from each
+ * translation unit.  An entry is keyed by the TU's compile command and is only
+ * valid while every file the TU read (the main file and all of its headers)
+ * still has the content hash recorded when the entry was stored.
+ */
+
+using ContentHash = uint64_t;
+using CompileCommand = std::vector<std::string>;
+
+// 64 bit FNV-1a, good enough to notice that a file changed
+ContentHash hash_bytes(const char *data, size_t size,
+                       ContentHash hash = 14695981039346656037ull);
+
+/*
+ * Headers are shared by many TUs, so each file is only read and hashed once
+ * per run.  Safe to use from several threads.
+ */
+class FileHashes {
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::pair<bool, ContentHash>> hashes_;
+
+public:
+  // returns false if the file can't be read
+  bool get(const std::string &filename, ContentHash &hash);
+};
+
+class TUCache {
+  std::string directory_;
+  FileHashes file_hashes_;
+
+  std::string entry_path(const CompileCommand &command) const;
+
+public:
+  explicit TUCache(const std::string &directory);
+
+  /*
+   * If there is an up to date entry for the command, put the cached records in
+   * records and return true.
+   */
+  bool load(const CompileCommand &command, std::string &records);
+  /*
+   * dependencies are the files that were read while parsing the TU
+   */
+  void store(const CompileCommand &command,
+             const std::vector<std::string> &dependencies,
+             const std::string &records);
+};
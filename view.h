@@ -5,11 +5,14 @@
 
 #include "geometry.h"
 #include "node_base.h"
+#include "spatial_index.h"
+#include "symbol_table.h"
 
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 struct NodeViewData;
@@ -24,30 +27,105 @@ struct NodeViewData {
   bool expanded;
 };
 
+/*
+ * One step of the DFS in dfs_grid_layout: the node it placed and enough of
+ * the search state to resume the DFS right after it.
+ */
+struct GridPlacement {
+  NodeBase *node;
+  int row;
+  int column;
+  size_t parent;     // the step that placed the DFS parent, npos for roots
+  size_t root_index; // the index in View::roots of the root of this tree
+  int max_column;    // the largest column placed up to and including this step
+  bool visible;      // in the logicalSubView when placed
+  Extent extent;
+};
+
+/*
+ * What dfs_grid_layout keeps between calls, so that after a few nodes are
+ * shown or hidden it only redoes the steps from the first one they affect.
+ * Code that changes the logicalSubView must either record the nodes in
+ * changed or invalidate the grid.
+ *
+ * The layouts run on the layout worker's copy of the view, which has the
+ * grid.  In the view on the GTK thread only changed and valid are kept up:
+ * they tell LayoutWorker::run what to send.
+ */
+struct GridLayout {
+  static const size_t npos = size_t(-1);
+
+  std::vector<GridPlacement> steps;
+  std::unordered_map<NodeBase *, size_t> step_of;
+  std::vector<double> row_height;
+  std::vector<double> row_sum; // row_sum[i] is the height of the rows above i
+  std::vector<double> column_offset;
+  /*
+   * Per column, the visible steps in it, and the steps that widened it with
+   * the width they widened it to (the last one is the column's width).  Both
+   * are in step order, so dropping the last steps only pops their backs.
+   */
+  std::vector<std::vector<size_t>> column_steps;
+  std::vector<std::vector<std::pair<size_t, double>>> column_widening;
+  std::vector<NodeBase *> changed; // shown or hidden since the last layout
+  bool valid;
+
+  GridLayout() : valid(false) {}
+  void invalidate() {
+    valid = false;
+    changed.clear();
+  }
+};
+
+// a node and where a layout put its box
+using NodePosition = std::pair<NodeBase *, Point>;
+
+/*
+ * The boxes a layout moved, so that only those positions are copied back
+ * from the copy of the view it ran on.  A layout that places every node sets
+ * all instead of listing them.
+ */
+struct LayoutMoves {
+  std::vector<NodeBase *> nodes;
+  bool all;
+
+  LayoutMoves() : all(false) {}
+  void clear() {
+    nodes.clear();
+    all = false;
+  }
+};
+
 struct PhysicalSubView {
   LogicalSubView nodes;
   Rectangle box;
   bool force_recalculate;
+  // sorted, the scale below which each node is a dot, see draw_view
+  std::vector<double> dot_scales;
 };
 
 struct View {
   ViewData viewData;
   /*
-   * This is a "weak link" to the graph object, perhaps a shared_ptr would be
-   * better...
+   * These are "weak links" to the graph object, perhaps a shared_ptr would be
+   * better...  name_to_node is indexed by the NameIds of names.
    */
-  std::unordered_map<Fullname, NodeBase *> *name_to_node;
+  const SymbolTable *names;
+  const std::vector<NodeBase *> *name_to_node;
   std::unordered_set<NodeBase *> logicalSubView;
   std::vector<NodeBase *> roots;
   PhysicalSubView physicalSubView;
+  GridLayout grid;
+  SpatialIndex spatial_index; // of the logicalSubView, for set_physicalView
+  LayoutMoves layout_moves;   // by the layouts, since it was last cleared
   double node_margin;
   double row_spacing;
   double column_spacing;
 
-  View() : name_to_node{nullptr} {}
-  View(std::unordered_map<Fullname, NodeBase *> *name_to_node)
-      : name_to_node(name_to_node), node_margin{10.0}, row_spacing{30.0},
-        column_spacing{30.0} {}
+  View() : names{nullptr}, name_to_node{nullptr} {}
+  View(const SymbolTable *names, const std::vector<NodeBase *> *name_to_node)
+      : names(names), name_to_node(name_to_node), node_margin{10.0},
+        row_spacing{30.0}, column_spacing{30.0} {}
 
   /*
    * Use this after copying a view to make the node boxes independent of one
@@ -29,19 +29,17 @@ string edge_in_view(const View &view, const EdgeBase *edge) {
 vector<LineSegment> PhysicalNeighborhood(const View &view,
                                          const NodeBase &node) {
   vector<LineSegment> result;
-  vector<EdgeBase *> neighborhood;
-  copy_if(node.neighborhood.outgoing.begin(), node.neighborhood.outgoing.end(),
-          back_inserter(neighborhood), [&view](const EdgeBase *edge) {
-            return view.logicalSubView.count(edge->head);
-          });
-  copy_if(node.neighborhood.incoming.begin(), node.neighborhood.incoming.end(),
-          back_inserter(neighborhood), [&view](const EdgeBase *edge) {
-            return view.logicalSubView.count(edge->tail);
-          });
-
-  transform(
-      neighborhood.begin(), neighborhood.end(), back_inserter(result),
-      [&view](const EdgeBase *edge) { return PhysicalEdge(view, *edge); });
+  result.reserve(node.degree());
+  for (auto edge : node.neighborhood.outgoing) {
+    if (view.logicalSubView.count(edge->head)) {
+      result.push_back(PhysicalEdge(view, *edge));
+    }
+  }
+  for (auto edge : node.neighborhood.incoming) {
+    if (view.logicalSubView.count(edge->tail)) {
+      result.push_back(PhysicalEdge(view, *edge));
+    }
+  }
   return result;
 }
 
@@ -60,28 +58,41 @@ void prune_isolated_nodes(View &view) {
 }
 
 void set_logicalView(View &view, const std::vector<NodeBase *> &nodes) {
+  view.grid.invalidate();
+  view.spatial_index.invalidate();
   view.logicalSubView.clear();
   copy(nodes.begin(), nodes.end(),
        inserter(view.logicalSubView, view.logicalSubView.begin()));
 }
 
+/*
+ * The nodes whose box or one of whose edges intersects the view box, looked up
+ * in the spatial index instead of testing the whole logicalSubView
+ */
 void set_physicalView(View &view, const Rectangle &view_box) {
   view.physicalSubView.nodes.clear();
-  copy_if(
-      view.logicalSubView.begin(), view.logicalSubView.end(),
-      inserter(view.physicalSubView.nodes, view.physicalSubView.nodes.begin()),
-      [&view, &view_box](const NodeBase *node) {
-        auto neighborhood = PhysicalNeighborhood(view, *node);
-        return any_of(neighborhood.begin(), neighborhood.end(),
-                      [&view_box](const LineSegment &physical_edge) {
-                        return view_box.Intersects(physical_edge);
-                      }) ||
-               view_box.Intersects(
-                   *view.viewData.at(const_cast<NodeBase *>(node)).box);
-      });
+  view.spatial_index.query(view, view_box, view.physicalSubView.nodes);
+  view.physicalSubView.box = view_box;
   view.physicalSubView.force_recalculate = false;
 }
 
+void add_to_physicalView(View &view, NodeBase *node) {
+  if (!view.logicalSubView.count(node)) {
+    return;
+  }
+  view.physicalSubView.nodes.insert(node);
+  for (auto edge : node->neighborhood.outgoing) {
+    if (view.logicalSubView.count(edge->head)) {
+      view.physicalSubView.nodes.insert(edge->head);
+    }
+  }
+  for (auto edge : node->neighborhood.incoming) {
+    if (view.logicalSubView.count(edge->tail)) {
+      view.physicalSubView.nodes.insert(edge->tail);
+    }
+  }
+}
+
 /*
 :let my_matches = []:hi my_group ctermbg=blue
 :let my_matches += ["=expand("<cword>")"]:match my_group /=join(my_matches,
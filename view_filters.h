@@ -15,3 +15,9 @@ void prune_isolated_nodes(View &view);
 
 void set_logicalView(View &view, const std::vector<NodeBase *>& nodes);
 void set_physicalView(View &view, const Rectangle &view_box);
+/*
+ * Adds a node that moved (e.g. is dragged) to the physicalSubView, with the
+ * other ends of its edges so those get drawn, instead of looking everything up
+ * again
+ */
+void add_to_physicalView(View &view, NodeBase *node);